@@ -0,0 +1,200 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+******************************************************************************/
+
+#include "box_scan.h"
+#include "fourcc.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define BOX_SCAN_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// avx2 is not part of the x86_64 baseline, it is compiled for the scan only
+// and used when the cpu has it
+#if defined(BOX_SCAN_SSE2) && defined(__GNUC__)
+#define BOX_SCAN_AVX2
+#include <immintrin.h>
+#endif
+
+namespace box_scan
+{
+	static uint32_t read_32(const uint8_t *p)
+	{
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+	}
+
+	// true if a fragment box with a valid size starts at pos
+	static bool is_fragment_box(const uint8_t *data, uint64_t size, uint64_t pos)
+	{
+		if (pos + 8 > size)
+			return false;
+
+		const uint32_t type = fourcc::get_type(data + pos);
+		const bool mdat = type == fourcc::mdat;
+		const bool moof = type == fourcc::moof;
+		if (!mdat && !moof && type != fourcc::styp && type != fourcc::emsg && type != fourcc::prft)
+			return false;
+
+		uint64_t box_size = read_32(data + pos);
+		uint64_t header_size = 8;
+		if (box_size == 1)
+		{
+			if (pos + 16 > size)
+				return false;
+			box_size = ((uint64_t)read_32(data + pos + 8) << 32) | read_32(data + pos + 12);
+			header_size = 16;
+		}
+		else if (box_size == 0)
+		{
+			return mdat; // only the last mdat extends to the end of the file
+		}
+
+		if (box_size < header_size || box_size > size - pos)
+			return false;
+
+		// a moof starts with its mfhd, this rejects most fourccs in sample data
+		if (moof)
+			return box_size >= header_size + 16 && fourcc::get_type(data + pos + header_size) == fourcc::mfhd;
+
+		return true;
+	}
+
+	// scan the type fields from offset t, one byte at a time
+	static uint64_t scan_scalar(const uint8_t *data, uint64_t size, uint64_t t)
+	{
+		for (; t + 4 <= size; t++)
+		{
+			const uint8_t c = data[t];
+			if ((c == 'm' || c == 's' || c == 'e' || c == 'p') && is_fragment_box(data, size, t - 4))
+				return t - 4;
+		}
+		return size;
+	}
+
+	uint64_t find_fragment_box_scalar(const uint8_t *data, uint64_t size)
+	{
+		return scan_scalar(data, size, 4);
+	}
+
+#ifdef BOX_SCAN_SSE2
+	static int first_bit(uint32_t mask)
+	{
+#ifdef _MSC_VER
+		unsigned long b;
+		_BitScanForward(&b, mask);
+		return (int)b;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	// the first and the last character of the fourcc are compared for 16 type
+	// fields at once, the few candidates are checked one at a time
+	static uint64_t scan_sse2(const uint8_t *data, uint64_t size)
+	{
+		const __m128i cm = _mm_set1_epi8('m');
+		const __m128i cs = _mm_set1_epi8('s');
+		const __m128i ce = _mm_set1_epi8('e');
+		const __m128i cp = _mm_set1_epi8('p');
+		const __m128i cf = _mm_set1_epi8('f');
+		const __m128i ct = _mm_set1_epi8('t');
+		const __m128i cg = _mm_set1_epi8('g');
+		uint64_t t = 4;
+
+		for (; t + 3 + 16 <= size; t += 16)
+		{
+			const __m128i first = _mm_loadu_si128((const __m128i *)(data + t));
+			const __m128i last = _mm_loadu_si128((const __m128i *)(data + t + 3));
+
+			// moof and mdat, styp, emsg and prft
+			__m128i hit = _mm_and_si128(_mm_cmpeq_epi8(first, cm), _mm_or_si128(_mm_cmpeq_epi8(last, cf), _mm_cmpeq_epi8(last, ct)));
+			hit = _mm_or_si128(hit, _mm_and_si128(_mm_cmpeq_epi8(first, cs), _mm_cmpeq_epi8(last, cp)));
+			hit = _mm_or_si128(hit, _mm_and_si128(_mm_cmpeq_epi8(first, ce), _mm_cmpeq_epi8(last, cg)));
+			hit = _mm_or_si128(hit, _mm_and_si128(_mm_cmpeq_epi8(first, cp), _mm_cmpeq_epi8(last, ct)));
+
+			for (uint32_t mask = (uint32_t)_mm_movemask_epi8(hit); mask; mask &= mask - 1)
+			{
+				const uint64_t pos = t + first_bit(mask) - 4;
+				if (is_fragment_box(data, size, pos))
+					return pos;
+			}
+		}
+		return scan_scalar(data, size, t);
+	}
+#endif
+
+#ifdef BOX_SCAN_AVX2
+	__attribute__((target("avx2")))
+	static uint64_t scan_avx2(const uint8_t *data, uint64_t size)
+	{
+		const __m256i cm = _mm256_set1_epi8('m');
+		const __m256i cs = _mm256_set1_epi8('s');
+		const __m256i ce = _mm256_set1_epi8('e');
+		const __m256i cp = _mm256_set1_epi8('p');
+		const __m256i cf = _mm256_set1_epi8('f');
+		const __m256i ct = _mm256_set1_epi8('t');
+		const __m256i cg = _mm256_set1_epi8('g');
+		uint64_t t = 4;
+
+		for (; t + 3 + 32 <= size; t += 32)
+		{
+			const __m256i first = _mm256_loadu_si256((const __m256i *)(data + t));
+			const __m256i last = _mm256_loadu_si256((const __m256i *)(data + t + 3));
+
+			__m256i hit = _mm256_and_si256(_mm256_cmpeq_epi8(first, cm), _mm256_or_si256(_mm256_cmpeq_epi8(last, cf), _mm256_cmpeq_epi8(last, ct)));
+			hit = _mm256_or_si256(hit, _mm256_and_si256(_mm256_cmpeq_epi8(first, cs), _mm256_cmpeq_epi8(last, cp)));
+			hit = _mm256_or_si256(hit, _mm256_and_si256(_mm256_cmpeq_epi8(first, ce), _mm256_cmpeq_epi8(last, cg)));
+			hit = _mm256_or_si256(hit, _mm256_and_si256(_mm256_cmpeq_epi8(first, cp), _mm256_cmpeq_epi8(last, ct)));
+
+			for (uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit); mask; mask &= mask - 1)
+			{
+				const uint64_t pos = t + first_bit(mask) - 4;
+				if (is_fragment_box(data, size, pos))
+					return pos;
+			}
+		}
+		return scan_scalar(data, size, t);
+	}
+
+	static bool has_avx2()
+	{
+		static const bool avx2 = __builtin_cpu_supports("avx2") != 0;
+		return avx2;
+	}
+#endif
+
+	uint64_t find_fragment_box(const uint8_t *data, uint64_t size)
+	{
+#ifdef BOX_SCAN_AVX2
+		if (has_avx2())
+			return scan_avx2(data, size);
+#endif
+#ifdef BOX_SCAN_SSE2
+		return scan_sse2(data, size);
+#else
+		return find_fragment_box_scalar(data, size);
+#endif
+	}
+
+	const char *get_scan_path()
+	{
+#ifdef BOX_SCAN_AVX2
+		if (has_avx2())
+			return "avx2";
+#endif
+#ifdef BOX_SCAN_SSE2
+		return "sse2";
+#else
+		return "scalar";
+#endif
+	}
+}
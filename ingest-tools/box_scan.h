@@ -0,0 +1,32 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+scan for the next fragment box header in a block of bytes, the walk over
+the box headers cannot continue after a damaged size field, this finds
+where the next fragment starts 16 or 32 bytes at a time
+
+******************************************************************************/
+
+#ifndef BOX_SCAN_H
+#define BOX_SCAN_H
+
+#include <cstdint>
+
+namespace box_scan
+{
+	// offset of the first styp, prft, emsg, moof or mdat box in [data, data + size)
+	// with a size field that fits the remaining bytes, size if there is none
+	uint64_t find_fragment_box(const uint8_t *data, uint64_t size);
+
+	// the same one byte at a time, used where there are no vector instructions
+	uint64_t find_fragment_box_scalar(const uint8_t *data, uint64_t size);
+
+	// instructions find_fragment_box uses on this cpu: avx2, sse2 or scalar
+	const char *get_scan_path();
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+******************************************************************************/
+
+#include "curl_share.h"
+
+static void lock_function(CURL *, curl_lock_data data, curl_lock_access, void *userp)
+{
+	((curl_share_t *)userp)->locks_[data].lock();
+}
+
+static void unlock_function(CURL *, curl_lock_data data, void *userp)
+{
+	((curl_share_t *)userp)->locks_[data].unlock();
+}
+
+curl_share_t::curl_share_t()
+	: share_(curl_share_init())
+{
+	curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, lock_function);
+	curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, unlock_function);
+	curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+	curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+	// connections are not shared, curl does not support a connection cache used
+	// by transfers in several threads, and each multi handle keeps its own pool
+	// so its HTTP/2 connection limits apply
+}
+
+curl_share_t::~curl_share_t()
+{
+	curl_share_cleanup(share_);
+}
+
+curl_share_t &curl_share_t::get()
+{
+	static curl_share_t share;
+	return share;
+}
+
+void curl_share_t::attach(CURL *curl)
+{
+	curl_easy_setopt(curl, CURLOPT_SHARE, share_);
+}
@@ -0,0 +1,41 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+dns cache and tls sessions shared by all curl handles, a new track or a
+reconnect after an origin failover reuses them instead of doing its own
+lookup and full tls handshake. each handle keeps its own connections
+
+******************************************************************************/
+
+#ifndef CURL_SHARE_H
+#define CURL_SHARE_H
+
+#include "curl/curl.h"
+#include <mutex>
+
+// share handle of the process, curl calls the lock functions when handles
+// in different threads use it
+struct curl_share_t
+{
+	curl_share_t();
+	~curl_share_t();
+
+	// the share used by all senders of the process
+	static curl_share_t &get();
+
+	// make a handle use the shared dns cache and tls sessions
+	void attach(CURL *curl);
+
+	CURLSH *share_;
+	std::mutex locks_[CURL_LOCK_DATA_LAST];
+
+private:
+	curl_share_t(const curl_share_t &);
+	curl_share_t &operator=(const curl_share_t &);
+};
+
+#endif
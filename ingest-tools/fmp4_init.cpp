@@ -10,6 +10,8 @@ retrieve init fragment or CMAF header from fmp4 file
 ******************************************************************************/
 
 #include "event/fmp4stream.h"
+#include "ingest_track.h"
+#include "mapped_file.h"
 #include <iostream>
 #include <fstream>
 #include <exception>
@@ -30,32 +32,43 @@ int main(int argc, char *argv[])
 	if (argc > 1)
 	{
 		string in_file(argv[1]);
-		ifstream input(in_file, ifstream::binary);
+		string out_file = "init_" + in_file;
+		if (argc > 2)
+			out_file = string(argv[2]);
 
-		if (!input.good())
+		// only the init segment, the mapped walk skips over the fragment payloads
+		if (argc <= 3)
+		{
+			ingest_track::track_store_t track;
+			if (!track.load_from_file(in_file))
+			{
+				cout << "failed loading input file: " << in_file << endl;
+				return 0;
+			}
+
+			ingest_track::segment_view_t init = track.get_init_segment();
+			ofstream out(out_file, ios::binary);
+			out.write((const char *)init.data_, init.size_);
+			return 0;
+		}
+
+		mapped_file_t input_file;
+
+		if (!input_file.open(in_file))
 		{
 			cout << "failed loading input file: " << string(argv[1]) << endl;
 			return 0;
 		}
 
 		cout << " reading fmp4 input file " << endl;
-		if(argc > 3)
-		    ingest_stream.load_from_file(input, false);
-		else 
-			ingest_stream.load_from_file(input, true);
+		mapped_streambuf input_buf(input_file);
+		istream input(&input_buf);
+		ingest_stream.load_from_file(input, false);
 
-		input.close();
+		input_file.close();
 
-		string out_file = "init_" + in_file;
-		if (argc > 2)
-			out_file = string(argv[2]);
-		
-		if (argc > 3) {
-			unsigned int nfrags = atoi(argv[3]);
-			ingest_stream.write_init_to_file(out_file,nfrags, true);
-		}
-		else
-			ingest_stream.write_init_to_file(out_file,0);
+		unsigned int nfrags = atoi(argv[3]);
+		ingest_stream.write_init_to_file(out_file,nfrags, true);
 	}
 	else
 	{
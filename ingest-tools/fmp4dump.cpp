@@ -10,35 +10,224 @@ Dump the contents of CMAF metadata including emsg content to cout
 ******************************************************************************/
 
 #include "event/fmp4stream.h"
+#include "ingest_track.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
 #include <exception>
 #include <memory>
+#include <string>
 
 using namespace fmp4_stream;
 using namespace std;
 
+static uint32_t read_32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+// bytes as json string content, bytes outside printable ascii are escaped
+static string json_escape(const uint8_t *data, size_t size)
+{
+	string s;
+	char esc[8];
+	for (size_t i = 0; i < size; i++)
+	{
+		if (data[i] >= 0x20 && data[i] < 0x7F && data[i] != '"' && data[i] != '\\')
+		{
+			s += (char)data[i];
+		}
+		else
+		{
+			snprintf(esc, sizeof(esc), "\\u%04x", data[i]);
+			s += esc;
+		}
+	}
+	return s;
+}
+
+// box type as json string content
+static string json_type(const uint8_t *type)
+{
+	return json_escape(type, 4);
+}
+
+// print the new findings of the validator as json lines, the messages can
+// contain box types and file names so they are escaped like the box types
+static void print_findings(ingest_track::track_validator_t &v)
+{
+	for (const ingest_track::finding_t &r : v.findings_)
+		cout << "{\"offset\":" << r.offset_ << ",\"check\":\"" << r.check_ << "\",\"message\":\"" <<
+			json_escape((const uint8_t *)r.message_.data(), r.message_.size()) << "\"}" << endl;
+	v.findings_.clear();
+}
+
+// the top level boxes of a segment at offset in the input as a json array,
+// the boxes of an init segment need not be next to each other in the input
+// so these have no offset
+static string json_boxes(const vector<uint8_t> &seg, uint64_t offset, bool with_offset)
+{
+	string s = "[";
+	uint64_t pos = 0;
+	while (pos + 8 <= seg.size())
+	{
+		uint64_t box_size = read_32(&seg[pos]);
+		if (box_size == 1 && pos + 16 <= seg.size())
+			box_size = ((uint64_t)read_32(&seg[pos + 8]) << 32) | read_32(&seg[pos + 12]);
+		if (box_size < 8 || box_size > seg.size() - pos)
+			break;
+
+		if (pos)
+			s += ",";
+		s += "{\"type\":\"" + json_type(&seg[pos + 4]) + "\",";
+		if (with_offset)
+			s += "\"offset\":" + to_string(offset + pos) + ",";
+		s += "\"size\":" + to_string(box_size) + "}";
+		pos += box_size;
+	}
+	return s + "]";
+}
+
 int main(int argc, char *argv[])
 {
 
 	ingest_stream ingest_stream;
 
+	// print the fragment table of a walk of the file, no index is written,
+	// with --samples the sample table of each fragment is decoded as it is printed
+	if (argc > 2 && (string(argv[1]) == "--index" || string(argv[1]) == "--samples"))
+	{
+		const bool print_samples = string(argv[1]) == "--samples";
+		vector<ingest_track::sample_entry_t> samples;
+		ingest_track::track_store_t track;
+		if (!track.load_from_file(argv[2]))
+		{
+			cout << "failed loading input file: " << string(argv[2]) << endl;
+			return 0;
+		}
+
+		cout << "timescale: " << track.timescale_ << " init segment size: " << track.init_size_ << " fragments: " << track.fragments_.size() << endl;
+		for (size_t i = 0; i < track.fragments_.size(); i++)
+		{
+			const ingest_track::fragment_entry_t &f = track.fragments_[i];
+			cout << "fragment: " << i << " offset: " << f.offset_ << " size: " << f.size_ <<
+				" tfdt: " << f.base_media_decode_time_ << " duration: " << f.duration_ <<
+				" sync: " << (int)f.sync_ << " sequence number: " << f.sequence_number_ << endl;
+
+			if (print_samples && track.get_samples(i, samples))
+			{
+				for (size_t k = 0; k < samples.size(); k++)
+				{
+					const ingest_track::sample_entry_t &e = samples[k];
+					cout << "  sample: " << k << " decode time: " << e.decode_time_ << " duration: " << e.duration_ <<
+						" size: " << e.size_ << " flags: 0x" << hex << e.flags_ << dec <<
+						" composition time offset: " << (int32_t)e.composition_time_offset_ << endl;
+				}
+			}
+		}
+		return 0;
+	}
+
+	// one json line per init segment and fragment, printed as each is read so the
+	// output starts at once and only one fragment is in memory, with --summary the
+	// totals of the track follow in a last line
+	if (argc > 2 && string(argv[1]) == "--json")
+	{
+		const bool print_summary = argc > 3 && string(argv[3]) == "--summary";
+		ingest_track::track_reader_t reader;
+		if (!reader.open(argv[2], false, 0))
+		{
+			cout << "failed loading input file: " << string(argv[2]) << endl;
+			return 0;
+		}
+
+		ingest_track::fragment_entry_t f;
+		ingest_track::segment_type_t type;
+		vector<uint8_t> seg;
+		uint64_t fragments = 0, bytes = 0, start_time = 0, duration = 0, sync_fragments = 0;
+		uint64_t min_duration = 0, max_duration = 0, max_size = 0;
+		while ((type = reader.read_segment(seg, f)) != ingest_track::end_of_input)
+		{
+			bytes += seg.size();
+			if (type == ingest_track::init_segment)
+			{
+				cout << "{\"record\":\"init\",\"offset\":" << f.offset_ << ",\"size\":" << seg.size() <<
+					",\"timescale\":" << reader.timescale_ << ",\"boxes\":" << json_boxes(seg, f.offset_, false) << "}" << endl;
+				continue;
+			}
+
+			cout << "{\"record\":\"fragment\",\"index\":" << fragments << ",\"offset\":" << f.offset_ << ",\"size\":" << f.size_ <<
+				",\"decode_time\":" << f.base_media_decode_time_ << ",\"duration\":" << f.duration_ <<
+				",\"sync\":" << (f.sync_ ? "true" : "false") << ",\"sequence_number\":" << f.sequence_number_ <<
+				",\"boxes\":" << json_boxes(seg, f.offset_, true) << "}" << endl;
+
+			if (!fragments)
+				start_time = f.base_media_decode_time_;
+			min_duration = fragments ? min(min_duration, f.duration_) : f.duration_;
+			max_duration = max(max_duration, f.duration_);
+			max_size = max(max_size, f.size_);
+			duration += f.duration_;
+			sync_fragments += f.sync_;
+			fragments++;
+		}
+
+		if (print_summary)
+			cout << "{\"record\":\"summary\",\"timescale\":" << reader.timescale_ << ",\"fragments\":" << fragments <<
+				",\"bytes\":" << bytes << ",\"start_time\":" << start_time << ",\"duration\":" << duration <<
+				",\"min_fragment_duration\":" << min_duration << ",\"max_fragment_duration\":" << max_duration <<
+				",\"max_fragment_size\":" << max_size << ",\"sync_fragments\":" << sync_fragments << "}" << endl;
+		return 0;
+	}
+
+	// check the cmaf and dash-if ingest constraints in one pass that reads a
+	// fragment at a time, the exit code is 1 when there are findings
+	if (argc > 2 && string(argv[1]) == "--validate")
+	{
+		ingest_track::track_reader_t reader;
+		if (!reader.open(argv[2], false, 0))
+		{
+			cout << "failed loading input file: " << string(argv[2]) << endl;
+			return 2;
+		}
+
+		ingest_track::track_validator_t validator;
+		ingest_track::fragment_entry_t f;
+		ingest_track::segment_type_t type;
+		vector<uint8_t> seg;
+		while ((type = reader.read_segment(seg, f)) != ingest_track::end_of_input)
+		{
+			if (type == ingest_track::init_segment)
+				validator.check_init_segment(&seg[0], seg.size(), f.offset_);
+			else
+				validator.check_media_segment(&seg[0], f);
+			print_findings(validator);
+		}
+		validator.check_end(reader.buf_offset_, reader.buf_.size());
+		print_findings(validator);
+
+		cout << "{\"fragments\":" << validator.fragments_ << ",\"findings\":" << validator.finding_count_ << "}" << endl;
+		return validator.finding_count_ ? 1 : 0;
+	}
+
 	if (argc > 1)
 	{
 
-		ifstream input(argv[1], ifstream::binary);
+		mapped_file_t input_file;
 
-		if (!input.good())
+		if (!input_file.open(argv[1]))
 		{
 			cout << "failed loading input file: " << string(argv[1]) << endl;
 			return 0;
 		}
 
 		cout << " reading fmp4 input file " << std::endl;
+		mapped_streambuf input_buf(input_file);
+		istream input(&input_buf);
 
 		try {
 			ingest_stream.load_from_file(input);
-			input.close();
 			ingest_stream.print();
 		}
 		catch (...)
@@ -51,5 +240,9 @@ int main(int argc, char *argv[])
 	{
 		cout << "fmp4dump: dumps fmp4/cmaf information about fragments and emsg to the screen" << endl;
 		cout << "usage: fmp4dump input_file" << endl;
+		cout << "       fmp4dump --index input_file prints the fragment index" << endl;
+		cout << "       fmp4dump --samples input_file prints the fragment index and the samples of each fragment" << endl;
+		cout << "       fmp4dump --json input_file [--summary] prints a json line for each init segment and fragment as it is read, with --summary the totals follow" << endl;
+		cout << "       fmp4dump --validate input_file checks the cmaf and dash-if ingest constraints, prints the findings as json lines" << endl;
 	}
 }
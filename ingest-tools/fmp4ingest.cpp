@@ -15,14 +15,25 @@ CMAF ingest from stored CMAF files, emulates a live encoder posting CMAF content
 #include <memory>
 #include <chrono>
 #include <thread>
+#include <functional>
+#include <atomic>
 #include <cstring>
 #include <bitset>
 #include <iomanip>
 #include "event/base64.h"
+#include "ingest_track.h"
+#include "curl_share.h"
+#include "ingest_metrics.h"
+#include "ingest_pacer.h"
+#include "ingest_schedule.h"
 
 using namespace fmp4_stream;
+using namespace ingest_track;
+using namespace ingest_metrics;
+using namespace ingest_schedule;
 using namespace std;
-bool stop_all = false;
+// global shutdown, read by every push, worker and stream thread
+atomic<bool> stop_all(false);
 
 // an ugly global cross thread variable for the cmaf presentation duration
 double cmaf_presentation_duration;
@@ -45,6 +56,7 @@ int get_remote_sync_epoch(uint64_t *res_time, string &wc_uri_)
 	if (curl)
 	{
 		curl_easy_setopt(curl, CURLOPT_URL, wc_uri_.c_str());
+		curl_share_t::get().attach(curl);
 
 		/* example.com is redirected, so we tell libcurl to follow redirection */
 		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_function);
@@ -93,6 +105,15 @@ struct push_options_t
 		, avail_seg_dur_(2000)
 		, announce_(2.0)
 		, anchor_scale_(1)
+		, multi_loops_(0)
+		, workers_(0)
+		, chunk_pacing_(false)
+		, http2_(false)
+		, retry_window_(10000)
+		, follow_(false)
+		, idle_timeout_(10000)
+		, stdin_name_("stdin.cmfv")
+		, index_(false)
 	{
 	}
 
@@ -109,10 +130,20 @@ struct push_options_t
 			" [--wc_uri]                     uri for fetching wall clock time default time.akamai.com \n"
 			" [--initialization]             SegmentTemplate@initialization sets the relative path for init segments, shall include $RepresentationID$ \n"
 			" [--media]                      SegmentTemplate@media sets the relative path for media segments, shall include $RepresentationID$ and $Time$ or $Number$ \n"
-//			" [--chunked]                    Use chunked Transfer-Encoding for POST (long running post) otherwise short running per fragment post \n"
+			" [--chunked]                    Use chunked Transfer-Encoding for POST (long running post) otherwise short running per fragment post \n"
 			" [--avail]                      signal an advertisment slot every arg1 ms with duration of arg2 ms \n"
 			" [--avail_seg_dur]              segment duration of avail segments in the timed metadata track in ms (default=2000ms) \n"
 			" [--seg_dur]                    default segment duration for KxD since unix epoch"
+			" [--multi]                      Drive all tracks from arg1 curl multi event loops instead of one thread per track\n"
+			" [--chunk_pacing]               Send each cmaf chunk (moof and mdat) at its own decode time, a segment is posted in one chunked POST from the thread of the track (not with --http2), with --chunked the chunks of the long running post \n"
+			" [--workers]                    Send all tracks from arg1 worker threads that take the due tracks from a shared deadline queue instead of one thread per track\n"
+			" [--http2]                      Multiplex all tracks over one HTTP/2 connection per event loop (h2 for https, h2c for http) \n"
+			" [--retry_window]               Resend failed media segments for at most arg1 ms (default=10000ms), 0 disables the resends \n"
+			" [--follow]                     Read the input files incrementally while they are written and send each fragment when it is complete, stdin (-) and fifos are always read this way \n"
+			" [--idle_timeout]               End a followed file when it did not grow for arg1 ms (default=10000ms) \n"
+			" [--stdin_name]                 Track name used in the url for stdin (default=stdin.cmfv) \n"
+			" [--index]                      Read and write the fragment index (input_file.fidx) next to the input files so later runs start without walking them \n"
+			" [--metrics]                    Write per track ingest metrics in the prometheus text format to file arg1 every second \n"
 			" [--dry_run]                    Do a dry run and write the output files to disk directly for checking file and box integrity\n"
 			" [--announce]                   specify the number of seconds in advance to presenation time to send an avail"
 			" [--auth]                       Basic Auth Password \n"
@@ -120,12 +151,13 @@ struct push_options_t
 			" [--sslcert]                    TLS 1.2 client certificate \n"
 			" [--sslkey]                     TLS private Key \n"
 			" [--sslkeypass]                 passphrase \n"
-			" <input_files>                  CMAF files to ingest (.cmf[atvm])\n"
+			" <input_files>                  CMAF files to ingest (.cmf[atvm]), - reads a track from stdin\n"
 
 			"\n");
 	}
 
-	void parse_options(int argc, char * argv[])
+	// false when the options cannot be used together
+	bool parse_options(int argc, char * argv[])
 	{
 		if (argc > 2)
 		{
@@ -137,11 +169,21 @@ struct push_options_t
 				if (t.compare("-r") == 0 || t.compare("--realtime") == 0) { realtime_ = true; continue; }
 				if (t.compare("--close_pp") == 0) { dont_close_ = false; continue; }
 				if (t.compare("--daemon") == 0) { daemon_ = true; continue; }
-//				if (t.compare("--chunked") == 0) { chunked_ = true; continue; }
+				if (t.compare("--chunked") == 0) { chunked_ = true; continue; }
 				if (t.compare("--wc_offset") == 0) { wc_off_ = true; continue; }
 				if (t.compare("--ism_offset") == 0) { ism_offset_ = strtoull(argv[++i], NULL,10); continue; }
 				if (t.compare("--ism_use_ms") == 0) { ism_use_ms_ = 1; anchor_scale_ = 1000; continue; }
 				if (t.compare("--dry_run") == 0) { dry_run_ = true; continue; }
+				if (t.compare("--multi") == 0) { multi_loops_ = atoi(argv[++i]); continue; }
+				if (t.compare("--workers") == 0) { workers_ = atoi(argv[++i]); continue; }
+				if (t.compare("--chunk_pacing") == 0) { chunk_pacing_ = true; continue; }
+				if (t.compare("--http2") == 0) { http2_ = true; continue; }
+				if (t.compare("--follow") == 0) { follow_ = true; continue; }
+				if (t.compare("--idle_timeout") == 0) { idle_timeout_ = atoi(argv[++i]); continue; }
+				if (t.compare("--stdin_name") == 0) { stdin_name_ = string(argv[++i]); continue; }
+				if (t.compare("--index") == 0) { index_ = true; continue; }
+				if (t.compare("--metrics") == 0) { metrics_file_ = string(argv[++i]); continue; }
+				if (t.compare("--retry_window") == 0) { retry_window_ = strtoull(argv[++i], NULL, 10); continue; }
 				if (t.compare("--wc_uri") == 0) { wc_uri_ = string(argv[++i]); continue; }
 				if (t.compare("--seg_dur") == 0) { seg_dur_ = strtoull(argv[++i], NULL, 10); continue; }
 				if (t.compare("--auth") == 0) { basic_auth_ = string(argv[++i]); continue; }
@@ -166,9 +208,39 @@ struct push_options_t
 				wc_time_start_ = ism_offset_;
 				wc_off_ = true;
 			}
+
+			// a long running post holds its sender for the whole track and HTTP/2
+			// multiplexing needs an event loop, the workers leave these to the event loops
+			if (workers_ && (chunked_ || http2_))
+			{
+				multi_loops_ = multi_loops_ ? multi_loops_ : 1;
+				workers_ = 0;
+				cout << "--workers with " << (chunked_ ? "--chunked" : "--http2") << " uses --multi " << multi_loops_ << " instead" << endl;
+			}
+
+			// the chunks of a segment post are written by the thread of the track, so
+			// the tracks cannot share the connection of an event loop
+			if (chunk_pacing_ && !chunked_)
+			{
+				if (http2_)
+				{
+					fprintf(stderr, "--chunk_pacing without --chunked cannot be used with --http2\n");
+					return false;
+				}
+
+				if (multi_loops_ || workers_)
+					cout << "--chunk_pacing without --chunked uses one thread per track instead of " << (workers_ ? "--workers" : "--multi") << endl;
+				multi_loops_ = 0;
+				workers_ = 0;
+			}
+
+			// the tracks can only share a connection when pushed from the same event loop
+			if (http2_ && !multi_loops_)
+				multi_loops_ = 1;
 		}
 		else
 			print_options();
+		return true;
 	}
 
 	string url_;
@@ -208,6 +280,34 @@ struct push_options_t
 	uint32_t ism_use_ms_;
 	uint32_t anchor_scale_;
 	uint64_t seg_dur_;
+	unsigned int multi_loops_; // number of curl multi event loops, 0 is one thread per track
+	unsigned int workers_; // number of worker threads sharing the deadline queue, 0 is one thread per track
+	bool chunk_pacing_; // send each cmaf chunk at its own decode time
+	bool http2_; // multiplex the tracks over HTTP/2 
+	uint64_t retry_window_; // milli seconds a failed media segment is resent
+	string metrics_file_; // file the metrics are written to, none when empty
+	bool follow_; // read the inputs incrementally while they are written
+	unsigned int idle_timeout_; // milli seconds a followed file may not grow before it ends
+	string stdin_name_; // track name of stdin
+	bool index_; // read and write the fragment index next to the inputs
+
+	// the input is read incrementally instead of loaded and mapped
+	bool is_stream(const string &file_name) const
+	{
+		return follow_ || track_reader_t::is_pipe(file_name);
+	}
+
+	// offset of the media timeline in the timescale, the wall clock time with --wc_offset
+	uint64_t get_time_base(uint32_t timescale) const
+	{
+		return wc_off_ ? wc_time_start_ * timescale / anchor_scale_ : 0;
+	}
+
+	// track name used in the url of an input
+	string get_track_name(const string &file_name) const
+	{
+		return file_name == "-" ? stdin_name_ : file_name;
+	}
 };
 
 struct ingest_post_state_t
@@ -219,20 +319,156 @@ struct ingest_post_state_t
 	uint32_t timescale_; // timescale of the media track
 	uint32_t offset_in_fragment_; // for partial chunked sending keep track of fragment offset
 	uint64_t start_time_stamp_; // ts offset
-	ingest_stream *str_ptr_; // pointer to the ingest stream
+	loop_timeline_t timeline_; // the track bytes, shared by all senders, and the timeline of the loops
+	uint64_t loop_index_; // loops sent before the current one
+	uint64_t segment_end_; // the post ends before this fragment, 0 posts all fragments
+	vector<uint8_t> seg_buf_; // fragment with the tfdt and mfhd patched for the loop
+	track_metrics_t *metrics_; // metrics of the track
 	bool is_done_; // flag set when the stream is done
 	string file_name_;
 	chrono::time_point<chrono::system_clock> *start_time_; // time point the post was started
-	push_options_t *opt_;
+	const push_options_t *opt_;
+	int loop_; // remaining loops of the long running post
+	bool can_pause_; // pause the transfer when a fragment is not due instead of sleeping
+	bool paused_; // flag set when the read callback paused the transfer
+	segment_view_t seg_; // the segment being sent in the long running post
+	ingest_pacer::media_clock_t clock_; // clock of the media timeline
+	chrono::steady_clock::time_point next_due_; // time point the next fragment is due
 };
 
+// streams the (init and) media fragments of a track into a single long running
+// post using chunked transfer encoding, in realtime mode each fragment is held
+// back until it is due
+size_t read_callback(char *buffer, size_t size, size_t nitems, void *userp)
+{
+	ingest_post_state_t *st = (ingest_post_state_t *)userp;
+	const track_store_t &l_track = *st->timeline_.track_;
+	const push_options_t &opt = *st->opt_;
+	size_t max_size = size * nitems;
+
+	if (st->is_done_)
+		return 0;
+
+	if (st->offset_in_fragment_ == 0)
+	{
+		if (!st->init_done_)
+		{
+			st->seg_ = l_track.get_init_segment();
+		}
+		else
+		{
+			// a segment post ends after the last chunk of the segment
+			if (st->segment_end_ && st->fnumber_ == st->segment_end_)
+				return 0;
+
+			if (st->fnumber_ == l_track.fragments_.size())
+			{
+				if (st->loop_ > 0 || st->loop_ == -1)
+				{
+					st->loop_index_++;
+					st->fnumber_ = 0;
+					if (st->loop_ > 0)
+						st->loop_--;
+				}
+				else
+				{
+					st->is_done_ = true;
+					if (opt.dont_close_)
+						return 0;
+
+					// end the post with the empty mfra segment
+					memcpy(buffer, empty_mfra, 8u);
+					return 8u;
+				}
+			}
+
+			if (opt.realtime_ && chrono::steady_clock::now() < st->next_due_)
+			{
+				if (st->can_pause_)
+				{
+					st->paused_ = true;
+					return CURL_READFUNC_PAUSE;
+				}
+				this_thread::sleep_until(st->next_due_);
+			}
+
+			if (stop_all)
+			{
+				st->is_done_ = true;
+				return 0;
+			}
+
+			st->seg_ = st->timeline_.get_segment(st->fnumber_, st->loop_index_, st->seg_buf_);
+		}
+	}
+
+	size_t n = st->seg_.size_ - st->offset_in_fragment_;
+	if (n > max_size)
+		n = max_size;
+
+	memcpy(buffer, st->seg_.data_ + st->offset_in_fragment_, n);
+	st->offset_in_fragment_ += (uint32_t)n;
+	st->metrics_->bytes_sent(n);
+
+	if (st->offset_in_fragment_ < st->seg_.size_)
+		return n;
+
+	// segment completely written to the post
+	st->offset_in_fragment_ = 0;
+
+	if (!st->init_done_)
+	{
+		st->init_done_ = true;
+		return n;
+	}
+
+	const uint64_t i = st->fnumber_++;
+	const double media_time = st->timeline_.get_media_time(i, st->loop_index_);
+	const double fdel = (double)(l_track.fragments_[i].duration_) / ((double)st->timescale_);
+
+	cout << " pushed media fragment: " << i << " file_name: " << st->file_name_ << " fragment duration: " << \
+		fdel << " seconds " << " media time elapsed: " << media_time + fdel << endl;
+	st->metrics_->fragment_sent(media_time, st->clock_.get_elapsed(chrono::steady_clock::now()), fdel);
+
+	// the next fragment is due when the media time of this one has elapsed, with
+	// chunk pacing each chunk is due at its own decode time
+	if (!opt.chunk_pacing_)
+		st->next_due_ = st->timeline_.get_deadline(st->clock_, i, st->loop_index_);
+	else if (i + 1 < l_track.fragments_.size())
+		st->next_due_ = st->timeline_.get_deadline(st->clock_, i + 1, st->loop_index_);
+	else
+		st->next_due_ = st->timeline_.get_deadline(st->clock_, 0, st->loop_index_ + 1);
+
+	return n;
+}
+
+// configure a handle for the long running post of the read callback
+struct curl_slist *set_chunked_post(CURL *curl, ingest_post_state_t *st, const string &post_url_string)
+{
+	struct curl_slist *chunk = NULL;
+
+	// HTTP/2 streams the body in data frames, the header is HTTP/1.1 only
+	if (!st->opt_->http2_)
+		chunk = curl_slist_append(chunk, "Transfer-Encoding: chunked");
+
+	curl_easy_setopt(curl, CURLOPT_URL, post_url_string.c_str());
+	curl_easy_setopt(curl, CURLOPT_POST, 1);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, NULL);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, -1L);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
+	curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
+	curl_easy_setopt(curl, CURLOPT_READDATA, st);
+
+	return chunk;
+}
+
 // generate segment name (init or media)
 // init shall not contain $Number$ or $Time$ 
 // media shall contain $Number$ or $Time$
 
 string get_path_from_template(
-	string &template_string,
-	string &file_name,
+	const string &template_string,
+	const string &file_name,
 	uint64_t time,
 	uint64_t number)
 {
@@ -297,22 +533,244 @@ string get_path_from_template(
 	return out_string;
 }
 
+// http version of the ingest connections, plain http uses h2c with prior knowledge
+long get_http_version(const push_options_t &opt)
+{
+	if (!opt.http2_)
+		return CURL_HTTP_VERSION_1_1;
+
+	if (opt.url_.compare(0, 8, "https://") == 0)
+		return CURL_HTTP_VERSION_2TLS;
+
+	return CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+}
+
+// tls and authentication settings shared by all ingest connections, the
+// handles also share the dns cache and tls sessions
+void set_curl_options(CURL *curl, const push_options_t &opt)
+{
+	curl_share_t::get().attach(curl);
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, get_http_version(opt));
+
+	// wait for a multiplexed connection instead of opening a new one, h2 and h2c
+	const long http_version = get_http_version(opt);
+	if (http_version == CURL_HTTP_VERSION_2TLS || http_version == CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE)
+		curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+
+	if (opt.basic_auth_.size())
+	{
+		curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+		curl_easy_setopt(curl, CURLOPT_USERNAME, opt.basic_auth_name_.c_str());
+		curl_easy_setopt(curl, CURLOPT_USERPWD, opt.basic_auth_.c_str());
+	}
+
+	if (opt.ssl_cert_.size())
+		curl_easy_setopt(curl, CURLOPT_SSLCERT, opt.ssl_cert_.c_str());
+
+	if (opt.ssl_key_.size())
+		curl_easy_setopt(curl, CURLOPT_SSLKEY, opt.ssl_key_.c_str());
+
+	if (opt.ssl_key_pass_.size())
+		curl_easy_setopt(curl, CURLOPT_KEYPASSWD, opt.ssl_key_pass_.c_str());
+}
+
+// url of a media segment, from the media segment template when it is set
+string get_media_url(const push_options_t &opt, const string &post_url, const string &file_name, uint64_t time, uint64_t number)
+{
+	if (!opt.segmentTemplate_media_.size())
+		return post_url;
+
+	return opt.url_ + "/" + get_path_from_template(
+		opt.segmentTemplate_media_,
+		file_name,
+		time,
+		number);
+}
+
+// blocking post of a segment, a timeout of 0 waits until the transfer is done
+CURLcode post_segment(CURL *curl, const string &url, segment_view_t seg, long timeout_ms, track_metrics_t *metrics)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(curl, CURLOPT_POST, 1);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (const char *)seg.data_);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)seg.size_);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+	CURLcode res = curl_easy_perform(curl);
+
+	metrics->post_done(chrono::duration<double>(chrono::steady_clock::now() - start).count(), seg.size_, res == CURLE_OK);
+	return res;
+}
+
+// resend the failed segments of a track that are due before until, sleeps
+// until then when there is nothing to send. with bounded the resends are
+// aborted at until so the next live segment goes out on time
+void send_retries(
+	CURL *curl,
+	retry_queue_t &retries,
+	const loop_timeline_t &timeline,
+	const push_options_t &opt,
+	const string &post_url,
+	const string &post_init_url,
+	const string &file_name,
+	track_metrics_t *metrics,
+	chrono::steady_clock::time_point until,
+	bool bounded)
+{
+	const track_store_t &l_track = *timeline.track_;
+	vector<uint8_t> seg_buf;
+
+	while (!stop_all)
+	{
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (now >= until)
+			break;
+
+		retry_entry_t *e = retries.get_due(now);
+		if (!e)
+		{
+			this_thread::sleep_until(retries.next_try() < until ? retries.next_try() : until);
+			continue;
+		}
+
+		const long timeout_ms = bounded ? (long)chrono::duration_cast<chrono::milliseconds>(until - now).count() + 1 : 0;
+		CURLcode res = CURLE_OK;
+
+		if (retries.resend_init_)
+		{
+			res = post_segment(curl, post_init_url, l_track.get_init_segment(), timeout_ms, metrics);
+			if (res == CURLE_OK)
+				retries.resend_init_ = false;
+		}
+
+		if (res == CURLE_OK)
+		{
+			res = post_segment(curl,
+				get_media_url(opt, post_url, file_name, timeline.get_decode_time(e->fnumber_, e->loop_), e->fnumber_),
+				timeline.get_segment(e->fnumber_, e->loop_, seg_buf),
+				timeout_ms,
+				metrics);
+			metrics->retry_done();
+		}
+
+		if (res == CURLE_OK)
+		{
+			cout << " resent media fragment: " << e->fnumber_ << " file_name: " << file_name << " attempt: " << e->attempts_ + 1 << endl;
+			retries.done();
+		}
+		else
+		{
+			fprintf(stderr, "resend of media segment failed: %s\n",
+				curl_easy_strerror(res));
+			retries.failed();
+		}
+	}
+}
+
+// post each segment of a track with chunked transfer encoding, the post is
+// opened when the previous one ends and in realtime mode the read callback
+// writes each chunk (moof and mdat) at its own decode time
+void post_chunked_segments(
+	CURL *curl,
+	ingest_post_state_t &st,
+	const push_options_t &opt,
+	const string &post_url,
+	const string &post_init_url,
+	const string &file_name,
+	track_metrics_t *metrics)
+{
+	const loop_timeline_t &timeline = st.timeline_;
+	const track_store_t &l_track = *timeline.track_;
+	struct curl_slist *chunk = NULL;
+	bool resend_init = false;
+	int loop = opt.loop_;
+
+	st.can_pause_ = false; // the callback sleeps until a chunk is due
+	st.clock_ = ingest_pacer::media_clock_t();
+
+	for (uint64_t loop_index = 0; !stop_all; loop_index++)
+	{
+		for (uint64_t i = 0; i < l_track.fragments_.size() && !stop_all; i = st.segment_end_)
+		{
+			if (resend_init)
+			{
+				// the init segment is a plain post without the chunked header
+				curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+				resend_init = post_segment(curl, post_init_url, l_track.get_init_segment(), 0, metrics) != CURLE_OK;
+			}
+
+			st.fnumber_ = i;
+			st.segment_end_ = l_track.get_segment_end((size_t)i);
+			st.loop_index_ = loop_index;
+			st.offset_in_fragment_ = 0;
+			st.init_done_ = true;
+			st.is_done_ = false;
+			st.next_due_ = opt.realtime_ ? timeline.get_deadline(st.clock_, i, loop_index) : chrono::steady_clock::now();
+
+			curl_slist_free_all(chunk);
+			chunk = set_chunked_post(curl, &st, get_media_url(opt, post_url, file_name, timeline.get_decode_time(i, loop_index), i));
+
+			// the read callback counts the bytes of the post
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			CURLcode res = curl_easy_perform(curl);
+			metrics->post_done(chrono::duration<double>(chrono::steady_clock::now() - start).count(), 0, res == CURLE_OK);
+
+			if (res != CURLE_OK)
+			{
+				// the rest of the segment is dropped, the next one starts with a styp
+				fprintf(stderr, "post of chunked segment failed: %s\n",
+					curl_easy_strerror(res));
+				resend_init = true;
+			}
+		}
+
+		if (loop == 0)
+			break;
+		if (loop > 0)
+			loop--;
+	}
+
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+	curl_slist_free_all(chunk);
+
+	if (!opt.dont_close_ && !stop_all)
+	{
+		segment_view_t mfra_seg = { empty_mfra, 8u };
+		if (post_segment(curl, post_url, mfra_seg, 0, metrics) != CURLE_OK)
+			fprintf(stderr, "post of mfra signalling segment failed\n");
+	}
+}
+
+// the track and the options are shared by all push threads and only read,
+// the loop count and the timeline of the loops are kept per thread
 int push_thread(
-	ingest_stream l_ingest_stream, 
-	push_options_t opt, 
+	loop_timeline_t timeline,
+	const push_options_t &opt, 
 	string post_url_string, 
-	std::string file_name)
+	std::string file_name,
+	track_metrics_t *metrics)
 {
+	const track_store_t &l_track = *timeline.track_;
+
+	// a stream that ended or a file that was damaged before its first moof
+	if (l_track.fragments_.empty())
+	{
+		cout << "no fragments in track: " << file_name << ", nothing to send" << endl;
+		return 0;
+	}
+
 	try
 	{
-		vector<uint8_t> init_seg_dat;
-		l_ingest_stream.get_init_segment_data(init_seg_dat);
+		segment_view_t init_seg_dat = l_track.get_init_segment();
 
 	    string out_file = "o_" + file_name;
 		ofstream outf = std::ofstream(out_file, std::ios::binary);
 		
 		if (outf.good() && opt.dry_run_)
-			outf.write((char *)&init_seg_dat[0], init_seg_dat.size());
+			outf.write((const char *)init_seg_dat.data_, init_seg_dat.size_);
 
 		// setup curl
 		CURL *curl;
@@ -330,27 +788,10 @@ int push_thread(
 		}
 
 		curl_easy_setopt(curl, CURLOPT_URL, post_init_url_string.c_str());
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (char *)&init_seg_dat[0]);
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)init_seg_dat.size());
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (const char *)init_seg_dat.data_);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)init_seg_dat.size_);
 
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-
-		if (opt.basic_auth_.size())
-		{
-			curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-			curl_easy_setopt(curl, CURLOPT_USERNAME, opt.basic_auth_name_.c_str());
-			curl_easy_setopt(curl, CURLOPT_USERPWD, opt.basic_auth_.c_str());
-		}
-
-		if (opt.ssl_cert_.size())
-			curl_easy_setopt(curl, CURLOPT_SSLCERT, opt.ssl_cert_.c_str());
-
-		if (opt.ssl_key_.size())
-			curl_easy_setopt(curl, CURLOPT_SSLKEY, opt.ssl_key_.c_str());
-
-		if (opt.ssl_key_pass_.size())
-			curl_easy_setopt(curl, CURLOPT_KEYPASSWD, opt.ssl_key_pass_.c_str());
+		set_curl_options(curl, opt);
 
 		if (!opt.dry_run_) {
 			res = curl_easy_perform(curl);
@@ -373,77 +814,104 @@ int push_thread(
 		ingest_post_state_t post_state = {};
 		post_state.error_state_ = false;
 		post_state.fnumber_ = 0;
-		post_state.frag_duration_ = l_ingest_stream.media_fragment_[0].get_duration();
+		post_state.frag_duration_ = l_track.fragments_[0].duration_;
 		post_state.init_done_ = true; // the init fragment was already sent
-		post_state.start_time_stamp_ = l_ingest_stream.media_fragment_[0].tfdt_.base_media_decode_time_;
-		post_state.str_ptr_ = &l_ingest_stream;
-		post_state.timescale_ = l_ingest_stream.init_fragment_.get_time_scale();
+		post_state.start_time_stamp_ = l_track.fragments_[0].base_media_decode_time_;
+		post_state.timeline_ = timeline;
+		post_state.timescale_ = l_track.timescale_;
 		post_state.is_done_ = false;
 		post_state.offset_in_fragment_ = 0;
 		post_state.opt_ = &opt;
 		post_state.file_name_ = file_name;
+		post_state.metrics_ = metrics;
 
 		chrono::time_point<chrono::system_clock> tp = chrono::system_clock::now();
 		post_state.start_time_ = &tp; // start time
 
 		curl_easy_setopt(curl, CURLOPT_URL, post_url_string.data());
 		curl_easy_setopt(curl, CURLOPT_POST, 1);
-		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, get_http_version(opt));
+
+		if (opt.chunk_pacing_ && !opt.chunked_ && !opt.dry_run_)
+		{
+			post_chunked_segments(curl, post_state, opt, post_url_string, post_init_url_string, file_name, metrics);
+			curl_easy_cleanup(curl);
+			return 0;
+		}
+
+		if (opt.chunked_ && !opt.dry_run_)
+		{
+			post_state.loop_ = opt.loop_;
+			post_state.clock_ = ingest_pacer::media_clock_t();
+			post_state.next_due_ = post_state.clock_.start_;
+			struct curl_slist *chunk = set_chunked_post(curl, &post_state, post_url_string);
+			int retry_count = 0;
+
+			while (!post_state.is_done_ && !stop_all)
+			{
+				uint64_t fnumber = post_state.fnumber_;
+				res = curl_easy_perform(curl);
+
+				if (res == CURLE_OK)
+					break;
+
+				fprintf(stderr, "long running post failed: %s\n",
+					curl_easy_strerror(res));
+
+				// restart the post with the init segment and the interrupted fragment
+				retry_count = post_state.fnumber_ == fnumber ? retry_count + 1 : 0;
+				if (retry_count == 2)
+					break;
+				post_state.is_done_ = false;
+				post_state.init_done_ = false;
+				post_state.offset_in_fragment_ = 0;
+				std::this_thread::sleep_for(std::chrono::milliseconds(300));
+			}
+
+			// only this track ends, the senders of the other tracks continue
+			curl_slist_free_all(chunk);
+			curl_easy_cleanup(curl);
+			return 0;
+		}
 
 		struct curl_slist *chunk = NULL;
-		chrono::time_point<chrono::system_clock> start_time = chrono::system_clock::now();
+		// the loops continue on the timeline of the first one, the clock is not reset
+		ingest_pacer::media_clock_t clock;
+		int loop = opt.loop_;
+		uint64_t loop_index = 0;
+		vector<uint8_t> seg_buf;
+		retry_queue_t retries;
 		
 		while (!stop_all)
 		{
 
-			for (uint64_t i = 0; i < l_ingest_stream.media_fragment_.size(); i++)
+			for (uint64_t i = 0; i < l_track.fragments_.size(); i++)
 			{
-				vector<uint8_t> media_seg_dat;
-				uint64_t media_seg_size = l_ingest_stream.get_media_segment_data(i, media_seg_dat);
+				segment_view_t media_seg_dat = timeline.get_segment(i, loop_index, seg_buf);
 			
 				if (!opt.dry_run_) {
 
-					if (opt.segmentTemplate_media_.size())
+					res = CURLE_OK;
+
+					// the connection failed before, post the init segment again first
+					if (retries.resend_init_)
 					{
-						uint64_t l_time = l_ingest_stream.media_fragment_[i].tfdt_.base_media_decode_time_;
+						res = post_segment(curl, post_init_url_string, init_seg_dat, 0, metrics);
+						if (res == CURLE_OK)
+							retries.resend_init_ = false;
+					}
 
-						post_url_string = opt.url_ + "/" + get_path_from_template(
-							opt.segmentTemplate_media_,
+					if (res == CURLE_OK)
+					{
+						post_url_string = get_media_url(
+							opt,
+							post_url_string,
 							file_name,
-							l_time,
+							timeline.get_decode_time(i, loop_index),
 							i);
-					    
-						curl_easy_setopt(curl, CURLOPT_URL, post_url_string.data());
-						curl_easy_setopt(curl, CURLOPT_POST, 1);
-						curl_easy_setopt(curl, 
-							CURLOPT_HTTP_VERSION, 
-							CURL_HTTP_VERSION_1_1
-						);
+						res = post_segment(curl, post_url_string, media_seg_dat, 0, metrics);
 					}
-					
-					curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (char *)&media_seg_dat[0]);
-					curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)media_seg_dat.size());
-					res = curl_easy_perform(curl);
 
-					if (res != CURLE_OK)
-					{
-						// media segment post failed resend the init segment and the segment
-						int retry_count = 0;
-						while (res != CURLE_OK)
-						{
-							curl_easy_setopt(curl, CURLOPT_URL, post_init_url_string.data());
-							curl_easy_setopt(curl, CURLOPT_POST, 1);
-							curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
-
-							curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (char *)&init_seg_dat[0]);
-							curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)init_seg_dat.size());
-							res = curl_easy_perform(curl);
-							std::this_thread::sleep_for(std::chrono::milliseconds(300));
-							retry_count++;
-							if (retry_count == 2)
-								break;
-						}
-					}
 					if (res == CURLE_OK)
 					{
 						fprintf(stderr, "post of media segment ok: %s\n",
@@ -451,75 +919,72 @@ int push_thread(
 					}
 					else
 					{
+						// resend the segment later without holding back the next ones
 						fprintf(stderr, "post of media segment failed: %s\n",
 							curl_easy_strerror(res));
+						retries.push(i, loop_index, opt.retry_window_);
+						retries.resend_init_ = true;
 					}
 				}
 				else
 				{
 					if (outf.good() && opt.dry_run_)
-						outf.write((char *)&media_seg_dat[0], media_seg_dat.size());
+						outf.write((const char *)media_seg_dat.data_, media_seg_dat.size_);
 				}
 
-				uint64_t c_tfdt = l_ingest_stream.media_fragment_[i].tfdt_.base_media_decode_time_;
-				uint64_t t_diff = c_tfdt - l_ingest_stream.media_fragment_[0].tfdt_.base_media_decode_time_;
+				uint64_t c_tfdt = l_track.fragments_[i].base_media_decode_time_;
+				uint64_t t_diff = c_tfdt - l_track.fragments_[0].base_media_decode_time_;
 
 				cout << " pushed media fragment: " << i << " file_name: " << post_state.file_name_ << " fragment duration: " << \
-					(l_ingest_stream.media_fragment_[i].get_duration()) / ((double)post_state.timescale_) << " seconds ";
+					(l_track.fragments_[i].duration_) / ((double)post_state.timescale_) << " seconds ";
 
 				if (post_state.timescale_ > 0)
-					cout << " media time elapsed: " << (double) (t_diff + l_ingest_stream.media_fragment_[i].get_duration()) / (double) post_state.timescale_ << endl;
+					cout << " media time elapsed: " << (double) (t_diff + l_track.fragments_[i].duration_) / (double) post_state.timescale_ << endl;
 
-				if (opt.realtime_)
-				{
-					chrono::duration<double> diff = chrono::system_clock::now() - start_time;
-					const double media_time = ((double)(c_tfdt - l_ingest_stream.get_start_time())) / l_ingest_stream.init_fragment_.get_time_scale();
+				const double media_time = timeline.get_media_time(i, loop_index);
+				metrics->fragment_sent(
+					media_time,
+					clock.get_elapsed(chrono::steady_clock::now()),
+					(double)l_track.fragments_[i].duration_ / l_track.timescale_);
 
+				// the failed segments are resent while waiting for the next one
+				chrono::steady_clock::time_point until;
 
-					// wait untill media time - frag_delay > elapsed time + initial offset
-					if ((diff.count()) < (media_time)) // if it is to early sleep until tfdt - frag_dur
-					{
-						double fdel = (double)(l_ingest_stream.media_fragment_[i].get_duration()) / ((double)post_state.timescale_);
-						// sleep but the maximum sleep time is one fragment duration
-						if (fdel < (media_time - diff.count()))
-							this_thread::sleep_for(chrono::duration<double>(fdel));
-						else
-							this_thread::sleep_for(chrono::duration<double>((media_time)-diff.count()));
-					}
-
+				if (opt.realtime_)
+				{
+					// the next fragment is due when the media time of this one has elapsed,
+					// the deadline is absolute so a late wake up is not carried over
+					until = timeline.get_deadline(clock, i, loop_index);
 				}
 				else
 				{ // non real time just sleep for 10 milli seconds
-					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					until = chrono::steady_clock::now() + std::chrono::milliseconds(10);
 				}
 
+				send_retries(curl, retries, timeline, opt, post_url_string, post_init_url_string, file_name, metrics, until, opt.realtime_);
+
 				//std::cout << " --- posting next segment ---- " << i << std::endl;
 				if (post_state.is_done_ || stop_all) {
-					i = (uint64_t)l_ingest_stream.media_fragment_.size();
+					i = (uint64_t)l_track.fragments_.size();
 					break;
 				}
 			}
 
-			if (opt.loop_ > 0) {
-				l_ingest_stream.patch_tfdt(
-					(uint64_t)opt.cmaf_presentation_duration_ \
-					* l_ingest_stream.init_fragment_.get_time_scale(), 
-					false
-				);
-				start_time = chrono::system_clock::now();
-				opt.loop_--;
+			if (loop > 0) {
+				loop_index++;
+				loop--;
 			}
-			else if (opt.loop_ == -1) {
-				l_ingest_stream.patch_tfdt(
-					(uint64_t)opt.cmaf_presentation_duration_ \
-					* l_ingest_stream.init_fragment_.get_time_scale(),
-					false
-				);
-				start_time = chrono::system_clock::now();
+			else if (loop == -1) {
+				loop_index++;
 			}
 			else 
 			{
-				stop_all = true;
+				// send what is left in the retransmission queue before closing
+				while (!retries.empty() && !stop_all)
+					send_retries(curl, retries, timeline, opt, post_url_string, post_init_url_string, file_name, metrics, retries.next_try() + chrono::milliseconds(1), false);
+
+				// only this track ends, the other tracks send their own loops
+				break;
 			}
 		}
 
@@ -528,11 +993,9 @@ int push_thread(
 		if (!opt.dont_close_ && !opt.dry_run_)
 		{
 			// post the empty mfra segment
-			curl_easy_setopt(curl, CURLOPT_URL, post_url_string.data());
-			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (char *)empty_mfra);
-			curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)8u);
+			segment_view_t mfra_seg = { empty_mfra, 8u };
 			/* Perform the request, res will get the return code */
-			res = curl_easy_perform(curl);
+			res = post_segment(curl, post_url_string, mfra_seg, 0, metrics);
 
 			/* Check for errors */
 			if (res != CURLE_OK)
@@ -556,37 +1019,716 @@ int push_thread(
 	return 0;
 }
 
+// state of a track that is pushed from a curl multi event loop
+struct multi_track_t : track_schedule_t
+{
+	loop_timeline_t timeline_; // the track, owned by main and shared by all event loops, and the timeline of the loops
+	string post_url_;
+	string post_init_url_;
+	string file_name_;
+	CURL *curl_;
+	uint64_t fnumber_; // next fragment to send
+	int loop_; // remaining loops
+	int retry_count_; // init resends after a failed media post
+	uint64_t loop_index_; // loops sent before the current one
+	vector<uint8_t> seg_buf_; // fragment with the tfdt and mfhd patched for the loop
+	bool busy_; // a request is in flight
+	track_metrics_t *metrics_; // metrics of the track
+	size_t request_size_; // bytes of the request in flight
+	chrono::steady_clock::time_point request_start_; // time point the request in flight was started
+	ofstream outf_; // output file for the dry run
+	ingest_post_state_t post_state_; // state of the long running post
+	struct curl_slist *chunk_; // headers of the long running post
+	ingest_pacer::media_clock_t clock_; // clock of the media timeline of the track
+};
+
+// set up the post of the next init, media or mfra segment of a track
+static void set_multi_request(multi_track_t *t, const push_options_t &opt)
+{
+	const track_store_t &l_track = *t->timeline_.track_;
+	const char *dat = NULL;
+	size_t size = 0;
+	string *url = &t->post_url_;
+	long timeout_ms = 0;
+
+	if (!t->init_done_)
+	{
+		segment_view_t init_seg_dat = l_track.get_init_segment();
+		dat = (const char *)init_seg_dat.data_;
+		size = init_seg_dat.size_;
+		url = &t->post_init_url_;
+	}
+	else if (t->closing_)
+	{
+		dat = (const char *)empty_mfra;
+		size = 8u;
+	}
+	else
+	{
+		uint64_t fnumber = t->fnumber_;
+		uint64_t loop = t->loop_index_;
+
+		if (t->retrying_)
+		{
+			fnumber = t->retries_.queue_.front().fnumber_;
+			loop = t->retries_.queue_.front().loop_;
+
+			// abort the resend when the next live segment is due
+			if (opt.realtime_ && !t->draining_)
+				timeout_ms = (long)chrono::duration_cast<chrono::milliseconds>(t->deadline_ - chrono::steady_clock::now()).count() + 1;
+		}
+
+		segment_view_t media_seg_dat = t->timeline_.get_segment(fnumber, loop, t->seg_buf_);
+		dat = (const char *)media_seg_dat.data_;
+		size = media_seg_dat.size_;
+		t->post_url_ = get_media_url(
+			opt,
+			t->post_url_,
+			t->file_name_,
+			t->timeline_.get_decode_time(fnumber, loop),
+			fnumber);
+	}
+
+	curl_easy_setopt(t->curl_, CURLOPT_URL, url->c_str());
+	curl_easy_setopt(t->curl_, CURLOPT_POST, 1);
+	curl_easy_setopt(t->curl_, CURLOPT_HTTP_VERSION, get_http_version(opt));
+	curl_easy_setopt(t->curl_, CURLOPT_POSTFIELDS, dat);
+	curl_easy_setopt(t->curl_, CURLOPT_POSTFIELDSIZE, (long)size);
+	curl_easy_setopt(t->curl_, CURLOPT_TIMEOUT_MS, timeout_ms);
+	t->request_size_ = size;
+	t->request_start_ = chrono::steady_clock::now();
+	t->busy_ = true;
+}
+
+// post the next segment of a track from an event loop
+static void start_multi_request(CURLM *multi, multi_track_t *t, const push_options_t &opt)
+{
+	if (opt.chunked_ && t->init_done_)
+	{
+		// all media fragments go in a single long running post
+		curl_slist_free_all(t->chunk_);
+		t->chunk_ = set_chunked_post(t->curl_, &t->post_state_, t->post_url_);
+		curl_easy_setopt(t->curl_, CURLOPT_HTTP_VERSION, get_http_version(opt));
+		t->fnumber_ = t->post_state_.fnumber_;
+		t->busy_ = true;
+		curl_multi_add_handle(multi, t->curl_);
+		return;
+	}
+
+	set_multi_request(t, opt);
+	curl_multi_add_handle(multi, t->curl_);
+}
+
+// update the track state after a request finished and compute the next deadline
+static void finish_multi_request(multi_track_t *t, CURLcode res, const push_options_t &opt)
+{
+	const track_store_t &l_track = *t->timeline_.track_;
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	t->busy_ = false;
+
+	if (!opt.chunked_ || !t->init_done_)
+		t->metrics_->post_done(chrono::duration<double>(now - t->request_start_).count(), t->request_size_, res == CURLE_OK);
+
+	// a resend keeps the deadline of the next live segment
+	if (t->retrying_)
+	{
+		t->retrying_ = false;
+		t->metrics_->retry_done();
+		if (res == CURLE_OK)
+		{
+			cout << " resent media fragment: " << t->retries_.queue_.front().fnumber_ << " file_name: " << t->file_name_ << \
+				" attempt: " << t->retries_.queue_.front().attempts_ + 1 << endl;
+			t->retries_.done();
+		}
+		else
+		{
+			fprintf(stderr, "resend of media segment failed: %s\n",
+				curl_easy_strerror(res));
+			t->retries_.failed();
+			t->init_done_ = false;
+			t->retry_count_ = 1;
+		}
+		return;
+	}
+
+	t->deadline_ = now;
+
+	if (opt.chunked_ && t->init_done_)
+	{
+		ingest_post_state_t &st = t->post_state_;
+		if (res == CURLE_OK)
+		{
+			t->is_done_ = true;
+			return;
+		}
+
+		fprintf(stderr, "long running post failed: %s\n",
+			curl_easy_strerror(res));
+
+		// restart the post with the init segment and the interrupted fragment
+		t->retry_count_ = st.fnumber_ == t->fnumber_ ? t->retry_count_ + 1 : 0;
+		t->is_done_ = st.is_done_ || t->retry_count_ == 2;
+		st.init_done_ = false;
+		st.offset_in_fragment_ = 0;
+		st.paused_ = false;
+		t->deadline_ = now + chrono::milliseconds(300);
+		return;
+	}
+
+	if (t->closing_)
+	{
+		if (res != CURLE_OK)
+			fprintf(stderr, "post of mfra signalling segment failed: %s\n",
+				curl_easy_strerror(res));
+		t->is_done_ = true;
+		return;
+	}
+
+	if (!t->init_done_)
+	{
+		if (res == CURLE_OK)
+		{
+			if (!t->retry_count_)
+				fprintf(stderr, "---- connection with server sucessfull %s\n",
+					curl_easy_strerror(res));
+			t->init_done_ = true;
+			t->retry_count_ = 0;
+		}
+		else if (t->retry_count_ == 0)
+		{
+			fprintf(stderr, "---- connection with server failed  %s\n",
+				curl_easy_strerror(res));
+			t->is_done_ = true; // nothing todo when connection fails
+		}
+		else if (++t->retry_count_ > 2)
+		{
+			// give up on the init segment, continue with the next media segment
+			t->init_done_ = true;
+			t->retry_count_ = 0;
+		}
+		else
+		{
+			t->deadline_ = now + chrono::milliseconds(300);
+		}
+		return;
+	}
+
+	if (res == CURLE_OK)
+	{
+		fprintf(stderr, "post of media segment ok: %s\n",
+			curl_easy_strerror(res));
+	}
+	else
+	{
+		fprintf(stderr, "post of media segment failed: %s\n",
+			curl_easy_strerror(res));
+		// resend the init segment before the next media segment, the
+		// failed segment is resent later without holding back the next ones
+		t->init_done_ = false;
+		t->retry_count_ = 1;
+		t->retries_.push(t->fnumber_, t->loop_index_, opt.retry_window_);
+	}
+
+	const uint64_t i = t->fnumber_;
+	const uint32_t timescale = l_track.timescale_;
+	const uint64_t c_tfdt = l_track.fragments_[i].base_media_decode_time_;
+	const uint64_t t_diff = c_tfdt - l_track.fragments_[0].base_media_decode_time_;
+
+	cout << " pushed media fragment: " << i << " file_name: " << t->file_name_ << " fragment duration: " << \
+		(l_track.fragments_[i].duration_) / ((double)timescale) << " seconds ";
+
+	if (timescale > 0)
+		cout << " media time elapsed: " << (double)(t_diff + l_track.fragments_[i].duration_) / (double)timescale << endl;
+
+	const double media_time = t->timeline_.get_media_time(i, t->loop_index_);
+	t->metrics_->fragment_sent(
+		media_time,
+		t->clock_.get_elapsed(now),
+		(double)l_track.fragments_[i].duration_ / timescale);
+
+	if (opt.realtime_)
+	{
+		// due when the media time of this fragment has elapsed
+		t->deadline_ = t->timeline_.get_deadline(t->clock_, i, t->loop_index_);
+	}
+	else
+	{ // non real time just wait for 10 milli seconds
+		t->deadline_ = now + chrono::milliseconds(10);
+	}
+
+	if (++t->fnumber_ < l_track.fragments_.size())
+		return;
+
+	if (t->loop_ > 0 || t->loop_ == -1)
+	{
+		t->loop_index_++;
+		t->fnumber_ = 0;
+		if (t->loop_ > 0)
+			t->loop_--;
+	}
+	else if (!t->retries_.empty())
+	{
+		t->draining_ = true;
+	}
+	else
+	{
+		t->end();
+	}
+}
+
+// reset the state of a track before its first request
+static void init_multi_track(multi_track_t *t, const push_options_t &opt)
+{
+	t->curl_ = curl_easy_init();
+	set_curl_options(t->curl_, opt);
+	curl_easy_setopt(t->curl_, CURLOPT_PRIVATE, t);
+	t->fnumber_ = 0;
+	t->loop_ = opt.loop_;
+	t->retry_count_ = 0;
+	t->loop_index_ = 0;
+	t->close_ = !opt.dont_close_ && !opt.dry_run_;
+	t->init_done_ = false;
+	t->closing_ = false;
+	t->busy_ = false;
+	t->retrying_ = false;
+	t->draining_ = false;
+	t->is_done_ = t->timeline_.track_->fragments_.size() == 0;
+	t->clock_ = ingest_pacer::media_clock_t(t->deadline_);
+	t->chunk_ = NULL;
+
+	ingest_post_state_t &st = t->post_state_;
+	st.init_done_ = true; // the init segment is posted before the long running post
+	st.fnumber_ = 0;
+	st.offset_in_fragment_ = 0;
+	st.timescale_ = t->timeline_.track_->timescale_;
+	st.timeline_ = t->timeline_;
+	st.is_done_ = false;
+	st.file_name_ = t->file_name_;
+	st.metrics_ = t->metrics_;
+	st.opt_ = &opt;
+	st.loop_ = opt.loop_;
+	st.loop_index_ = 0;
+	st.can_pause_ = true;
+	st.paused_ = false;
+	st.clock_ = t->clock_;
+	st.next_due_ = t->deadline_;
+
+	if (opt.dry_run_)
+	{
+		t->outf_.open("o_" + t->file_name_, std::ios::binary);
+		segment_view_t init_seg_dat = t->timeline_.track_->get_init_segment();
+		t->outf_.write((const char *)init_seg_dat.data_, init_seg_dat.size_);
+		t->init_done_ = true;
+	}
+}
+
+// release the handle and the output file of a track
+static void close_multi_track(multi_track_t *t)
+{
+	curl_easy_cleanup(t->curl_);
+	curl_slist_free_all(t->chunk_);
+	if (t->outf_.is_open())
+		t->outf_.close();
+}
+
+// push a set of tracks from a single curl multi handle, each track
+// waits for its own deadline instead of sleeping in its own thread
+int push_multi_thread(const vector<multi_track_t *> &tracks, const push_options_t &opt)
+{
+	CURLM *multi = curl_multi_init();
+	size_t active = 0;
+
+	if (opt.http2_)
+	{
+		// all tracks of the event loop share a single multiplexed connection
+		curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+		curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, 1L);
+	}
+
+	for (auto t : tracks)
+	{
+		init_multi_track(t, opt);
+		if (!t->is_done_)
+			active++;
+	}
+
+	while (active && !stop_all)
+	{
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		chrono::steady_clock::time_point next = now + chrono::seconds(1);
+
+		for (auto t : tracks)
+		{
+			if (t->post_state_.paused_)
+			{
+				// resume the long running post once the next fragment is due
+				if (t->post_state_.next_due_ <= now)
+				{
+					t->post_state_.paused_ = false;
+					curl_easy_pause(t->curl_, CURLPAUSE_CONT);
+				}
+				else if (t->post_state_.next_due_ < next)
+				{
+					next = t->post_state_.next_due_;
+				}
+				continue;
+			}
+
+			if (t->busy_ || t->is_done_)
+				continue;
+
+			if (!t->get_due(now, next))
+			{
+				if (t->is_done_)
+					active--;
+				continue;
+			}
+
+			if (opt.dry_run_)
+			{
+				segment_view_t media_seg_dat = t->timeline_.get_segment(t->fnumber_, t->loop_index_, t->seg_buf_);
+				t->outf_.write((const char *)media_seg_dat.data_, media_seg_dat.size_);
+				finish_multi_request(t, CURLE_OK, opt);
+				if (t->is_done_)
+					active--;
+				next = now;
+				continue;
+			}
+			start_multi_request(multi, t, opt);
+		}
+
+		int running = 0;
+		curl_multi_perform(multi, &running);
+
+		CURLMsg *msg;
+		int msgs_left = 0;
+		while ((msg = curl_multi_info_read(multi, &msgs_left)))
+		{
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			multi_track_t *t = NULL;
+			CURL *curl = msg->easy_handle;
+			CURLcode res = msg->data.result;
+			curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&t);
+			curl_multi_remove_handle(multi, curl);
+			finish_multi_request(t, res, opt);
+			if (t->is_done_)
+				active--;
+			next = now;
+		}
+
+		chrono::milliseconds wait = chrono::duration_cast<chrono::milliseconds>(next - chrono::steady_clock::now());
+		if (wait.count() > 0)
+			curl_multi_wait(multi, NULL, 0, (int)wait.count(), NULL);
+	}
+
+	for (auto t : tracks)
+	{
+		if (t->busy_)
+			curl_multi_remove_handle(multi, t->curl_);
+		close_multi_track(t);
+	}
+	curl_multi_cleanup(multi);
+
+	return 0;
+}
+
+// send the next segment of the tracks that are due from the shared deadline
+// queue, a track is put back with the time point it is due again
+int push_worker_thread(ingest_pacer::deadline_queue_t &queue, const vector<multi_track_t *> &tracks, atomic<size_t> &active, const push_options_t &opt)
+{
+	ingest_pacer::run_worker(queue, active, [&](size_t id, chrono::steady_clock::time_point &next)
+	{
+		if (stop_all)
+		{
+			queue.close();
+			return false;
+		}
+
+		multi_track_t *t = tracks[id];
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		next = now + chrono::seconds(1);
+
+		if (t->get_due(now, next))
+		{
+			if (opt.dry_run_)
+			{
+				segment_view_t media_seg_dat = t->timeline_.get_segment(t->fnumber_, t->loop_index_, t->seg_buf_);
+				t->outf_.write((const char *)media_seg_dat.data_, media_seg_dat.size_);
+				finish_multi_request(t, CURLE_OK, opt);
+			}
+			else
+			{
+				set_multi_request(t, opt);
+				finish_multi_request(t, curl_easy_perform(t->curl_), opt);
+			}
+
+			// the next deadline or a resend may be due already
+			next = chrono::steady_clock::now();
+		}
+		return !t->is_done_;
+	});
+	return 0;
+}
+
+// push a set of tracks from a pool of worker threads, the deadlines of all
+// tracks are kept in one queue instead of each track sleeping in a thread
+int push_worker_pool(const vector<multi_track_t *> &tracks, const push_options_t &opt)
+{
+	ingest_pacer::deadline_queue_t queue;
+	atomic<size_t> active(0);
+
+	for (size_t k = 0; k < tracks.size(); k++)
+	{
+		init_multi_track(tracks[k], opt);
+		if (tracks[k]->is_done_)
+			continue;
+		active++;
+		queue.push(k, tracks[k]->deadline_);
+	}
+
+	vector<shared_ptr<thread> > workers;
+	for (unsigned int n = 0; active && n < opt.workers_; n++)
+		workers.push_back(shared_ptr<thread>(new thread(push_worker_thread, ref(queue), cref(tracks), ref(active), cref(opt))));
+	for (auto &w : workers)
+		w->join();
+
+	for (auto t : tracks)
+		close_multi_track(t);
+	return 0;
+}
+
+// push a track that is read incrementally from stdin, a fifo or a file that is
+// still being written, each fragment is posted as soon as all its bytes were read
+int push_stream_thread(
+	const push_options_t &opt,
+	string post_url_string,
+	string file_name,
+	track_metrics_t *metrics)
+{
+	track_reader_t reader;
+	if (!reader.open(file_name, opt.follow_, opt.idle_timeout_))
+	{
+		cout << "failed opening input: " << file_name << endl;
+		return 0;
+	}
+
+	const string track_name = opt.get_track_name(file_name);
+	string post_init_url_string = post_url_string;
+
+	if (opt.segmentTemplate_init_.size())
+	{
+		post_init_url_string = opt.url_ + "/" + get_path_from_template(
+			opt.segmentTemplate_init_,
+			track_name,
+			0,
+			0);
+	}
+
+	ofstream outf;
+	if (opt.dry_run_)
+		outf.open("o_" + track_name, std::ios::binary);
+
+	CURL *curl = curl_easy_init();
+	set_curl_options(curl, opt);
+
+	vector<uint8_t> init_seg, seg;
+	fragment_entry_t f;
+	segment_type_t type;
+	CURLcode res = CURLE_OK;
+	bool resend_init = false;
+	uint64_t fnumber = 0;
+	uint64_t start_tfdt = 0;
+	ingest_pacer::media_clock_t clock;
+
+	while (!stop_all && (type = reader.read_segment(seg, f)) != end_of_input)
+	{
+		segment_view_t seg_dat = { seg.data(), seg.size() };
+
+		if (type == init_segment)
+		{
+			// a new init segment, a relay may start a new stream in the same input
+			init_seg = seg;
+			reader.time_offset_ = opt.get_time_base(reader.timescale_);
+
+			if (opt.dry_run_)
+			{
+				outf.write((const char *)seg_dat.data_, seg_dat.size_);
+				continue;
+			}
+
+			res = post_segment(curl, post_init_url_string, seg_dat, 0, metrics);
+			resend_init = res != CURLE_OK;
+			fprintf(stderr, res == CURLE_OK ? "---- connection with server sucessfull %s\n" : "---- connection with server failed  %s\n",
+				curl_easy_strerror(res));
+			continue;
+		}
+
+		if (!init_seg.size())
+		{
+			cout << "media fragment before the init segment dropped, file_name: " << file_name << endl;
+			continue;
+		}
+
+		if (opt.dry_run_)
+		{
+			outf.write((const char *)seg_dat.data_, seg_dat.size_);
+		}
+		else
+		{
+			res = CURLE_OK;
+
+			// the connection failed before, post the init segment again first
+			if (resend_init)
+			{
+				segment_view_t init_seg_dat = { init_seg.data(), init_seg.size() };
+				res = post_segment(curl, post_init_url_string, init_seg_dat, 0, metrics);
+				resend_init = res != CURLE_OK;
+			}
+
+			if (res == CURLE_OK)
+			{
+				post_url_string = get_media_url(opt, post_url_string, track_name, f.base_media_decode_time_, fnumber);
+				res = post_segment(curl, post_url_string, seg_dat, 0, metrics);
+			}
+
+			if (res == CURLE_OK)
+			{
+				fprintf(stderr, "post of media segment ok: %s\n",
+					curl_easy_strerror(res));
+			}
+			else
+			{
+				fprintf(stderr, "post of media segment failed: %s\n",
+					curl_easy_strerror(res));
+				resend_init = true;
+			}
+		}
+
+		const double timescale = reader.timescale_ ? (double)reader.timescale_ : 1.0;
+		if (!fnumber)
+		{
+			clock = ingest_pacer::media_clock_t();
+			start_tfdt = f.base_media_decode_time_;
+		}
+
+		const double media_time = (double)(f.base_media_decode_time_ - start_tfdt) / timescale;
+		const double fdel = (double)f.duration_ / timescale;
+
+		cout << " pushed media fragment: " << fnumber << " file_name: " << track_name << " fragment duration: " << \
+			fdel << " seconds " << " media time elapsed: " << media_time + fdel << endl;
+		metrics->fragment_sent(media_time, clock.get_elapsed(chrono::steady_clock::now()), fdel);
+
+		// a file that is read faster than it is written is paced like a stored file,
+		// a jump in the decode times of the input holds it back one fragment at most
+		if (opt.realtime_)
+		{
+			chrono::steady_clock::time_point due = clock.get_deadline(f.base_media_decode_time_ - start_tfdt, reader.timescale_);
+			chrono::steady_clock::time_point max_due = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(fdel));
+			this_thread::sleep_until(due < max_due ? due : max_due);
+		}
+		fnumber++;
+	}
+
+	// only close with mfra if dont close is not set
+	if (!opt.dont_close_ && !opt.dry_run_)
+	{
+		segment_view_t mfra_seg = { empty_mfra, 8u };
+		res = post_segment(curl, post_url_string, mfra_seg, 0, metrics);
+		if (res != CURLE_OK)
+			fprintf(stderr, "post of mfra signalling segment failed: %s\n",
+				curl_easy_strerror(res));
+	}
+
+	// the end of this input does not stop the other tracks
+	cout << "end of input: " << file_name << endl;
+	curl_easy_cleanup(curl);
+	return 0;
+}
+
+// write the metrics file every second until the senders are done
+int metrics_thread(metrics_registry_t &metrics, const string &file_name, const atomic<bool> &done)
+{
+	while (!done)
+	{
+		if (!metrics.write_file(file_name))
+			cout << "failed writing metrics file: " << file_name << endl;
+		this_thread::sleep_for(chrono::seconds(1));
+	}
+
+	// the final counters
+	metrics.write_file(file_name);
+	return 0;
+}
+
+// load the mapped input files taken from next until all are loaded,
+// loaded is set for each track that has media and a timescale
+int load_thread(const push_options_t &opts, vector<track_store_t> &l_tracks, vector<char> &loaded, atomic<size_t> &next)
+{
+	for (size_t i = next++; i < l_tracks.size(); i = next++)
+	{
+		// streams are read by their sender while they are written
+		const string &file_name = opts.input_files_[i];
+		if (opts.is_stream(file_name))
+			continue;
+
+		track_store_t &l_track = l_tracks[i];
+		loaded[i] = l_track.load_from_file(file_name, opts.index_) && l_track.timescale_;
+	}
+	return 0;
+}
+
 int main(int argc, char * argv[])
 {
 	push_options_t opts;
-	opts.parse_options(argc, argv);
-	vector<ingest_stream> l_istreams(opts.input_files_.size());
+	if (!opts.parse_options(argc, argv))
+		return 1;
+	curl_global_init(CURL_GLOBAL_ALL);
+	vector<track_store_t> l_tracks(opts.input_files_.size());
 	typedef shared_ptr<thread> thread_ptr;
 	typedef vector<thread_ptr> threads_t;
-	ingest_stream meta_ingest_stream; 
+	track_store_t meta_track;
 	threads_t threads;
 	int l_index = 0;
-
+	metrics_registry_t metrics;
+	atomic<bool> metrics_done(false);
+	thread_ptr metrics_writer;
+
+	// the files are loaded on a bounded number of threads, so the startup takes as
+	// long as the largest file instead of all files one after another. the mapped
+	// files are read only once loaded and shared by all senders
+	vector<char> loaded(opts.input_files_.size(), 0);
+	atomic<size_t> next_file(0);
+	unsigned int load_threads = thread::hardware_concurrency();
+	load_threads = (unsigned int)min<size_t>(load_threads ? load_threads : 4, opts.input_files_.size());
+	threads_t loaders;
+
+	for (unsigned int k = 1; k < load_threads; k++)
+		loaders.push_back(thread_ptr(new thread(load_thread, cref(opts), ref(l_tracks), ref(loaded), ref(next_file))));
+	load_thread(opts, l_tracks, loaded, next_file);
+	for (auto &t : loaders)
+		t->join();
+
+	// the results are checked in input order, the output does not depend on which load finished first
 	for (auto it = opts.input_files_.begin(); it != opts.input_files_.end(); ++it)
 	{
-		ifstream input(*it, ifstream::binary);
+		if (opts.is_stream(*it))
+		{
+			l_index++;
+			continue;
+		}
 
-		if (!input.good())
+		const track_store_t &l_track = l_tracks[l_index];
+
+		if (!loaded[l_index])
 		{
 			std::cout << "failed loading input file: [cmf[tavm]]" << string(*it) << endl;
 			push_options_t::print_options();
 			return 0;
 		}
 
-		ingest_stream &l_ingest_stream = l_istreams[l_index];
-		l_ingest_stream.load_from_file(input);
-
-		// patch the tfdt values with an offset time
-		if (opts.wc_off_)
-			l_ingest_stream.patch_tfdt(opts.wc_time_start_, true, opts.anchor_scale_);
-
-		
-		double l_duration = (double) l_ingest_stream.get_duration() / (double) l_ingest_stream.init_fragment_.get_time_scale();
+		double l_duration = (double) l_track.get_duration() / (double) l_track.timescale_;
 
 		if (l_duration > opts.cmaf_presentation_duration_) {
 			opts.cmaf_presentation_duration_ = l_duration;
@@ -594,7 +1736,6 @@ int main(int argc, char * argv[])
 		}
 
 		l_index++;
-		input.close();
 	}
 	l_index = 0;
 
@@ -616,14 +1757,109 @@ int main(int argc, char * argv[])
 			opts.wc_time_start_);
 
 		
-		ifstream input_file_meta(avail_track, ifstream::binary);
-		meta_ingest_stream.load_from_file(input_file_meta);
+		if (!meta_track.load_from_file(avail_track) || meta_track.fragments_.empty())
+		{
+			std::cout << "failed loading avail track: " << avail_track << ", no avails are sent" << endl;
+			opts.avail_ = 0;
+		}
+
+		// the avail track is generated at the wall clock time, its timeline has no base
+	}
+
+	if (opts.metrics_file_.size())
+		metrics_writer.reset(new thread(metrics_thread, ref(metrics), cref(opts.metrics_file_), cref(metrics_done)));
+
+	if (opts.multi_loops_ || opts.workers_)
+	{
+		typedef shared_ptr<multi_track_t> track_ptr;
+		vector<track_ptr> tracks;
+		vector<vector<multi_track_t *> > loop_tracks(opts.multi_loops_ ? opts.multi_loops_ : 1);
+		chrono::steady_clock::time_point media_start = chrono::steady_clock::now();
+
+		if (opts.avail_)
+		{
+			track_ptr t(new multi_track_t());
+			t->timeline_ = loop_timeline_t(meta_track, opts.cmaf_presentation_duration_, 0);
+			t->file_name_ = "out_avail_track.cmfm";
+			t->post_url_ = opts.url_ + "/Streams(" + t->file_name_ + ")";
+			t->metrics_ = metrics.add_track(t->file_name_);
+			t->deadline_ = media_start;
+			tracks.push_back(t);
+
+			// delay the media tracks compared to the timed metadata track
+			media_start += chrono::milliseconds(opts.announce_ ? 1000 * (int)opts.announce_ : 4000);
+		}
+
+		for (auto it = opts.input_files_.begin(); it != opts.input_files_.end(); ++it)
+		{
+			// streams have a sender thread of their own
+			if (opts.is_stream(*it))
+			{
+				const string track_name = opts.get_track_name(*it);
+				cout << "push stream thread: " << track_name << endl;
+				thread_ptr thread_n(new thread(push_stream_thread, cref(opts), opts.url_ + "/Streams(" + track_name + ")", *it, metrics.add_track(track_name)));
+				threads.push_back(thread_n);
+				l_index++;
+				continue;
+			}
+
+			track_ptr t(new multi_track_t());
+			t->timeline_ = loop_timeline_t(l_tracks[l_index], opts.cmaf_presentation_duration_, opts.get_time_base(l_tracks[l_index].timescale_));
+			l_index++;
+			t->file_name_ = *it;
+			t->post_url_ = opts.url_ + "/Streams(" + *it + ")";
+			t->metrics_ = metrics.add_track(t->file_name_);
+			t->deadline_ = media_start;
+			tracks.push_back(t);
+		}
+
+		for (size_t k = 0; k < tracks.size(); k++)
+		{
+			multi_track_t *t = tracks[k].get();
+			t->post_init_url_ = t->post_url_;
+			if (opts.segmentTemplate_init_.size())
+			{
+				t->post_init_url_ = opts.url_ + "/" + get_path_from_template(
+					opts.segmentTemplate_init_,
+					t->file_name_,
+					0,
+					0);
+			}
+			loop_tracks[k % loop_tracks.size()].push_back(t);
+		}
+
+		for (auto& l : loop_tracks)
+		{
+			if (!l.size())
+				continue;
+			if (opts.workers_)
+			{
+				cout << "push worker pool: " << l.size() << " tracks " << opts.workers_ << " workers" << endl;
+				threads.push_back(thread_ptr(new thread(push_worker_pool, cref(l), cref(opts))));
+				continue;
+			}
+			cout << "push event loop: " << l.size() << " tracks" << endl;
+			thread_ptr thread_n(new thread(push_multi_thread, cref(l), cref(opts)));
+			threads.push_back(thread_n);
+		}
+
+		for (auto& th : threads)
+			th->join();
+
+		metrics_done = true;
+		if (metrics_writer)
+			metrics_writer->join();
+
+		return 0;
+	}
+
+	if (opts.avail_)
+	{
+		string avail_track = "out_avail_track.cmfm";
+		string post_url_string = opts.url_ + "/Streams(" + "out_avail_track.cmfm" + ")";
 
-		//if (opts.wc_off_) no need to patch again
-		//	meta_ingest_stream.patch_tfdt(opts.wc_time_start_, true, opts.anchor_scale_);
-		
 		// create the file
-		thread_ptr thread_n(new thread(push_thread, meta_ingest_stream, opts, post_url_string, avail_track));
+		thread_ptr thread_n(new thread(push_thread, loop_timeline_t(meta_track, opts.cmaf_presentation_duration_, 0), cref(opts), post_url_string, avail_track, metrics.add_track(avail_track)));
 		threads.push_back(thread_n);
 
 		// delay the media threads compared to the timed metadata tracks
@@ -635,18 +1871,24 @@ int main(int argc, char * argv[])
 
 	for (auto it = opts.input_files_.begin(); it != opts.input_files_.end(); ++it)
 	{
-		string post_url_string = opts.url_ + "/Streams(" + *it + ")";
+		string post_url_string = opts.url_ + "/Streams(" + opts.get_track_name(*it) + ")";
 
-		if(it->substr(it->find_last_of(".") + 1) == "cmfm")
+		if (opts.is_stream(*it))
+		{
+			cout << "push stream thread: " << post_url_string << endl;
+			thread_ptr thread_n(new thread(push_stream_thread, cref(opts), post_url_string, (string) *it, metrics.add_track(opts.get_track_name(*it))));
+			threads.push_back(thread_n);
+		}
+		else if(it->substr(it->find_last_of(".") + 1) == "cmfm")
         {
 			cout << "push thread: " << post_url_string << endl;
-		    thread_ptr thread_n(new thread(push_thread, l_istreams[l_index], opts, post_url_string, (string) *it));
+		    thread_ptr thread_n(new thread(push_thread, loop_timeline_t(l_tracks[l_index], opts.cmaf_presentation_duration_, opts.get_time_base(l_tracks[l_index].timescale_)), cref(opts), post_url_string, (string) *it, metrics.add_track(*it)));
 		    threads.push_back(thread_n);
         }
 		else 
 		{
 			cout << "push thread: " << post_url_string << endl;
-			thread_ptr thread_n(new thread(push_thread, l_istreams[l_index], opts, post_url_string, (string) *it));
+			thread_ptr thread_n(new thread(push_thread, loop_timeline_t(l_tracks[l_index], opts.cmaf_presentation_duration_, opts.get_time_base(l_tracks[l_index].timescale_)), cref(opts), post_url_string, (string) *it, metrics.add_track(*it)));
 			threads.push_back(thread_n);
 		}	
 		l_index++;
@@ -655,4 +1897,8 @@ int main(int argc, char * argv[])
 
 	for (auto& th : threads)
 		th->join();
+
+	metrics_done = true;
+	if (metrics_writer)
+		metrics_writer->join();
 }
@@ -0,0 +1,754 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+end to end ingest throughput benchmark, runs fmp4ingest with a pool of workers
+in non realtime mode against a loopback receiver in this process for an
+increasing number of tracks and reports fragments/s, MB/s, post latency and cpu
+time per track. all tracks have the same number of fragments, so every track is
+sent until the end of a run, and a run only counts when all fragments arrived
+
+******************************************************************************/
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "box_scan.h"
+#include "fourcc.h"
+#include "ingest_metrics.h"
+
+using namespace std;
+
+#ifndef BENCH_TEST_FILES
+#define BENCH_TEST_FILES "test_files"
+#endif
+
+struct bench_options_t
+{
+	bench_options_t()
+		: max_tracks_(8)
+		, bitrate_(20)
+		, fragments_(30)
+		, test_files_(BENCH_TEST_FILES)
+		, scan_mb_(0)
+		, workers_(max(1u, thread::hardware_concurrency()))
+	{
+	}
+
+	static void print_options()
+	{
+		printf("Usage: fmp4ingest_bench [options]\n");
+		printf(
+			" [--fmp4ingest]                 path of the fmp4ingest executable (default next to this one)\n"
+			" [--tracks]                     run with 1, 2, 4 .. up to arg1 synthetic video tracks (default=8)\n"
+			" [--bitrate]                    bitrate of the synthetic video tracks in Mbit/s (default=20)\n"
+			" [--fragments]                  number of fragments of each track, the text tracks are cut to it (default=30)\n"
+			" [--test_files]                 directory with the .cmft tracks that are pushed in each run\n"
+			" [--workers]                    number of fmp4ingest worker threads (default=number of cores)\n"
+			" [--scan]                       only compare the vector and the scalar fragment box scan over arg1 MB\n"
+			"\n");
+	}
+
+	bool parse_options(int argc, char *argv[])
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			string t(argv[i]);
+			if (i + 1 == argc) { print_options(); return false; }
+			if (t.compare("--fmp4ingest") == 0) { fmp4ingest_ = string(argv[++i]); continue; }
+			if (t.compare("--tracks") == 0) { max_tracks_ = atoi(argv[++i]); continue; }
+			if (t.compare("--bitrate") == 0) { bitrate_ = atoi(argv[++i]); continue; }
+			if (t.compare("--fragments") == 0) { fragments_ = atoi(argv[++i]); continue; }
+			if (t.compare("--test_files") == 0) { test_files_ = string(argv[++i]); continue; }
+			if (t.compare("--scan") == 0) { scan_mb_ = atoi(argv[++i]); continue; }
+			if (t.compare("--workers") == 0) { workers_ = atoi(argv[++i]); continue; }
+			print_options();
+			return false;
+		}
+
+		if (!fmp4ingest_.size())
+		{
+			string self(argv[0]);
+			size_t pos = self.find_last_of("/");
+			fmp4ingest_ = (pos == string::npos ? string(".") : self.substr(0, pos)) + "/fmp4ingest";
+		}
+		return max_tracks_ > 0 && bitrate_ > 0 && fragments_ > 0 && workers_ > 0;
+	}
+
+	string fmp4ingest_;
+	int max_tracks_;
+	int bitrate_; // Mbit/s
+	int fragments_;
+	string test_files_;
+	int scan_mb_; // size of the scan benchmark, 0 runs the ingest benchmark
+	int workers_;
+};
+
+static void write_32(vector<uint8_t> &out, uint32_t v)
+{
+	out.push_back((uint8_t)(v >> 24));
+	out.push_back((uint8_t)(v >> 16));
+	out.push_back((uint8_t)(v >> 8));
+	out.push_back((uint8_t)v);
+}
+
+// append a box with the given payload
+static void write_box(vector<uint8_t> &out, const char *type, const vector<uint8_t> &payload)
+{
+	write_32(out, (uint32_t)(payload.size() + 8));
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), payload.begin(), payload.end());
+}
+
+// write a video track of fragments of 2 seconds (50 samples of 512 at timescale 12800),
+// only the boxes that fmp4ingest reads for timing are in the moov
+static bool write_synthetic_track(const string &file_name, int bitrate, int fragments)
+{
+	const uint32_t timescale = 12800;
+	const uint32_t sample_count = 50;
+	const uint32_t sample_duration = 512;
+	const uint32_t sample_size = (uint32_t)((uint64_t)bitrate * 1000000 * 2 / 8 / sample_count);
+	vector<uint8_t> out, p;
+
+	// ftyp
+	p.clear();
+	p.insert(p.end(), { 'c', 'm', 'f', 'c', 0, 0, 0, 0, 'c', 'm', 'f', 'c', 'i', 's', 'o', '6' });
+	write_box(out, "ftyp", p);
+
+	// moov with trak/mdia/mdhd and mvex/trex
+	vector<uint8_t> mdhd, mdia, trak, trex, mvex, moov;
+	write_32(mdhd, 0); // version and flags
+	write_32(mdhd, 0); // creation time
+	write_32(mdhd, 0); // modification time
+	write_32(mdhd, timescale);
+	write_32(mdhd, 0); // duration
+	write_32(mdhd, 0x55c40000); // language und, pre defined
+	write_box(mdia, "mdhd", mdhd);
+	write_box(trak, "mdia", mdia);
+	write_box(moov, "trak", trak);
+	write_32(trex, 0); // version and flags
+	write_32(trex, 1); // track id
+	write_32(trex, 1); // sample description index
+	write_32(trex, sample_duration);
+	write_32(trex, sample_size);
+	write_32(trex, 0); // sample flags
+	write_box(mvex, "trex", trex);
+	write_box(moov, "mvex", mvex);
+	write_box(out, "moov", moov);
+
+	ofstream f(file_name, ios::binary);
+	f.write((const char *)&out[0], out.size());
+
+	vector<uint8_t> mdat(sample_size * sample_count, 0);
+	for (int i = 0; i < fragments; i++)
+	{
+		vector<uint8_t> mfhd, tfhd, tfdt, trun, traf, moof, frag;
+		write_32(mfhd, 0);
+		write_32(mfhd, i + 1);
+		write_32(tfhd, 0x020000); // default base is moof
+		write_32(tfhd, 1);
+		write_32(tfdt, 0x01000000); // version 1
+		write_32(tfdt, 0);
+		write_32(tfdt, (uint32_t)i * sample_count * sample_duration);
+		write_32(trun, 0x000001); // data offset, durations and sizes from trex
+		write_32(trun, sample_count);
+		write_32(trun, 0); // data offset, set below
+		write_box(traf, "tfhd", tfhd);
+		write_box(traf, "tfdt", tfdt);
+		write_box(traf, "trun", trun);
+		write_box(moof, "mfhd", mfhd);
+		write_box(moof, "traf", traf);
+		write_box(frag, "moof", moof);
+
+		// the samples start after the moof and the mdat header
+		const uint32_t data_offset = (uint32_t)frag.size() + 8;
+		const size_t trun_data_offset = frag.size() - 4;
+		frag[trun_data_offset] = (uint8_t)(data_offset >> 24);
+		frag[trun_data_offset + 1] = (uint8_t)(data_offset >> 16);
+		frag[trun_data_offset + 2] = (uint8_t)(data_offset >> 8);
+		frag[trun_data_offset + 3] = (uint8_t)data_offset;
+
+		out.clear();
+		write_32(out, (uint32_t)(mdat.size() + 8));
+		out.insert(out.end(), { 'm', 'd', 'a', 't' });
+		f.write((const char *)&frag[0], frag.size());
+		f.write((const char *)&out[0], out.size());
+		f.write((const char *)&mdat[0], mdat.size());
+	}
+	return f.good();
+}
+
+// offsets of the top level boxes of a track file, the last one is the file size
+static vector<uint64_t> get_top_level_boxes(const vector<uint8_t> &data)
+{
+	vector<uint64_t> offsets;
+	uint64_t pos = 0;
+	while (pos + 8 <= data.size())
+	{
+		offsets.push_back(pos);
+		uint64_t box_size = ((uint64_t)data[pos] << 24) | (data[pos + 1] << 16) | (data[pos + 2] << 8) | data[pos + 3];
+		if (box_size == 1 && pos + 16 <= data.size())
+		{
+			box_size = 0;
+			for (int i = 8; i < 16; i++)
+				box_size = (box_size << 8) | data[pos + i];
+		}
+		if (box_size < 8 || box_size > data.size() - pos)
+			break;
+		pos += box_size;
+	}
+	offsets.push_back(pos);
+	return offsets;
+}
+
+static bool read_file(const string &file_name, vector<uint8_t> &data)
+{
+	ifstream in(file_name, ios::binary);
+	data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+	return in.good() || in.eof();
+}
+
+// number of fragments of a track file
+static int count_fragments(const string &file_name)
+{
+	vector<uint8_t> data;
+	if (!read_file(file_name, data))
+		return 0;
+
+	int fragments = 0;
+	const vector<uint64_t> boxes = get_top_level_boxes(data);
+	for (size_t b = 0; b + 1 < boxes.size(); b++)
+	{
+		if (fourcc::get_type(&data[boxes[b]]) == fourcc::moof)
+			fragments++;
+	}
+	return fragments;
+}
+
+// copy the init segment and the first fragments of a track, up to and including
+// the mdat of the last fragment
+static bool copy_track_head(const string &from, const string &to, int fragments)
+{
+	vector<uint8_t> data;
+	if (!read_file(from, data))
+		return false;
+
+	uint64_t end = 0;
+	int count = 0;
+	const vector<uint64_t> boxes = get_top_level_boxes(data);
+	for (size_t b = 0; b + 1 < boxes.size() && count <= fragments; b++)
+	{
+		const uint32_t type = fourcc::get_type(&data[boxes[b]]);
+		if (type == fourcc::moof)
+			count++;
+		if (count > fragments)
+			break;
+		end = boxes[b + 1];
+		if (type == fourcc::mdat && count == fragments)
+			break;
+	}
+
+	ofstream out(to, ios::binary);
+	out.write((const char *)&data[0], end);
+	return out.good();
+}
+
+// counts the bytes and moof boxes of the posted bodies
+struct receiver_stats_t
+{
+	receiver_stats_t() : requests_(0), bytes_(0), fragments_(0) {}
+
+	atomic<uint64_t> requests_;
+	atomic<uint64_t> bytes_;
+	atomic<uint64_t> fragments_;
+};
+
+// walks the top level boxes of a body that arrives in pieces
+struct box_counter_t
+{
+	box_counter_t() : header_size_(0), remaining_(0) {}
+
+	void feed(const uint8_t *data, size_t size, receiver_stats_t &stats)
+	{
+		while (size)
+		{
+			if (remaining_)
+			{
+				const size_t n = (size_t)min<uint64_t>(remaining_, size);
+				remaining_ -= n;
+				data += n;
+				size -= n;
+				continue;
+			}
+
+			header_[header_size_++] = *data++;
+			size--;
+			if (header_size_ < 8)
+				continue;
+
+			uint64_t box_size = ((uint64_t)header_[0] << 24) | (header_[1] << 16) | (header_[2] << 8) | header_[3];
+			if (box_size == 1)
+			{
+				// 64 bit large size after the type
+				if (header_size_ < 16)
+					continue;
+				box_size = 0;
+				for (int i = 8; i < 16; i++)
+					box_size = (box_size << 8) | header_[i];
+			}
+
+			if (fourcc::get_type(header_) == fourcc::moof)
+				stats.fragments_++;
+			remaining_ = box_size > header_size_ ? box_size - header_size_ : 0;
+			header_size_ = 0;
+		}
+	}
+
+	uint8_t header_[16];
+	size_t header_size_;
+	uint64_t remaining_;
+};
+
+// reads a connection until count bytes are buffered, false when it was closed
+static bool fill(int fd, string &buf, size_t count)
+{
+	char tmp[65536];
+	while (buf.size() < count)
+	{
+		ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+		if (n <= 0)
+			return false;
+		buf.append(tmp, (size_t)n);
+	}
+	return true;
+}
+
+// reads a line ending with crlf from the connection, false when it was closed
+static bool read_line(int fd, string &buf, string &line)
+{
+	size_t pos;
+	while ((pos = buf.find("\r\n")) == string::npos)
+	{
+		if (!fill(fd, buf, buf.size() + 1))
+			return false;
+	}
+	line = buf.substr(0, pos);
+	buf.erase(0, pos + 2);
+	return true;
+}
+
+// reads size bytes of a body and feeds them to the box counter
+static bool read_body(int fd, string &buf, uint64_t size, box_counter_t &boxes, receiver_stats_t &stats)
+{
+	while (size)
+	{
+		if (!buf.size() && !fill(fd, buf, 1))
+			return false;
+
+		const size_t n = (size_t)min<uint64_t>(size, buf.size());
+		boxes.feed((const uint8_t *)buf.data(), n, stats);
+		stats.bytes_ += n;
+		buf.erase(0, n);
+		size -= n;
+	}
+	return true;
+}
+
+// serves the posts of one connection, both content length and chunked bodies
+static void serve_connection(int fd, receiver_stats_t *stats)
+{
+	string buf;
+	string line;
+
+	for (;;)
+	{
+		uint64_t content_length = 0;
+		bool chunked = false;
+		bool expect_continue = false;
+
+		// request line and headers
+		if (!read_line(fd, buf, line))
+			break;
+		while (read_line(fd, buf, line) && line.size())
+		{
+			string name = line.substr(0, line.find(':'));
+			transform(name.begin(), name.end(), name.begin(), ::tolower);
+			string value = line.find(':') == string::npos ? string() : line.substr(line.find(':') + 1);
+			if (name == "content-length")
+				content_length = strtoull(value.c_str(), NULL, 10);
+			else if (name == "transfer-encoding" && value.find("chunked") != string::npos)
+				chunked = true;
+			else if (name == "expect" && value.find("100") != string::npos)
+				expect_continue = true;
+		}
+
+		if (expect_continue)
+		{
+			const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+			send(fd, cont, sizeof(cont) - 1, MSG_NOSIGNAL);
+		}
+
+		box_counter_t boxes;
+		bool ok = true;
+		if (chunked)
+		{
+			for (;;)
+			{
+				ok = read_line(fd, buf, line);
+				const uint64_t chunk_size = ok ? strtoull(line.c_str(), NULL, 16) : 0;
+				if (!ok || !chunk_size)
+					break;
+				ok = read_body(fd, buf, chunk_size, boxes, *stats) && read_line(fd, buf, line);
+				if (!ok)
+					break;
+			}
+			// trailer
+			while (ok && read_line(fd, buf, line) && line.size())
+				;
+		}
+		else
+		{
+			ok = read_body(fd, buf, content_length, boxes, *stats);
+		}
+
+		if (!ok)
+			break;
+
+		stats->requests_++;
+		const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+		send(fd, response, sizeof(response) - 1, MSG_NOSIGNAL);
+	}
+	close(fd);
+}
+
+// loopback http receiver, a thread per connection
+struct loopback_receiver_t
+{
+	loopback_receiver_t() : listen_fd_(-1), port_(0) {}
+
+	bool start()
+	{
+		listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+		int one = 1;
+		setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		socklen_t len = sizeof(addr);
+		if (bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd_, 128) != 0 ||
+			getsockname(listen_fd_, (sockaddr *)&addr, &len) != 0)
+			return false;
+
+		port_ = ntohs(addr.sin_port);
+		accept_thread_ = thread(&loopback_receiver_t::accept_loop, this);
+		return true;
+	}
+
+	void accept_loop()
+	{
+		for (;;)
+		{
+			int fd = accept(listen_fd_, NULL, NULL);
+			if (fd < 0)
+				break;
+			connections_.push_back(thread(serve_connection, fd, &stats_));
+		}
+	}
+
+	// stop accepting and wait for the connections, call after the sender exited
+	void stop()
+	{
+		shutdown(listen_fd_, SHUT_RDWR);
+		close(listen_fd_);
+		accept_thread_.join();
+		for (auto &c : connections_)
+			c.join();
+	}
+
+	int listen_fd_;
+	int port_;
+	thread accept_thread_;
+	vector<thread> connections_;
+	receiver_stats_t stats_;
+};
+
+// latency quantile in seconds from the histograms of all tracks in the metrics file,
+// the upper bound of the bucket that holds the quantile
+static double get_latency_quantile(const string &metrics_file, double q)
+{
+	const size_t bucket_count = ingest_metrics::latency_bucket_count + 1;
+	vector<uint64_t> counts(bucket_count, 0);
+	ifstream in(metrics_file);
+	string line;
+	const string prefix = "fmp4ingest_post_latency_seconds_bucket{";
+
+	while (getline(in, line))
+	{
+		if (line.compare(0, prefix.size(), prefix) != 0)
+			continue;
+
+		const size_t le = line.find("le=\"");
+		if (le == string::npos)
+			continue;
+
+		const string bound = line.substr(le + 4, line.find('"', le + 4) - le - 4);
+		size_t b = 0;
+		while (b < ingest_metrics::latency_bucket_count && atof(bound.c_str()) != ingest_metrics::latency_buckets[b])
+			b++;
+		if (bound == "+Inf")
+			b = ingest_metrics::latency_bucket_count;
+		counts[b] += strtoull(line.substr(line.find_last_of(' ') + 1).c_str(), NULL, 10);
+	}
+
+	// the buckets are cumulative, the +Inf bucket holds all posts
+	const uint64_t total = counts[bucket_count - 1];
+	for (size_t b = 0; b < ingest_metrics::latency_bucket_count; b++)
+	{
+		if (total && counts[b] >= q * total)
+			return ingest_metrics::latency_buckets[b];
+	}
+	return total ? ingest_metrics::latency_buckets[ingest_metrics::latency_bucket_count - 1] : 0;
+}
+
+// .cmft files in a directory
+static vector<string> get_text_tracks(const string &dir_name)
+{
+	vector<string> files;
+	DIR *dir = opendir(dir_name.c_str());
+	if (!dir)
+		return files;
+
+	while (dirent *e = readdir(dir))
+	{
+		string name(e->d_name);
+		if (name.size() > 5 && name.compare(name.size() - 5, 5, ".cmft") == 0)
+			files.push_back(dir_name + "/" + name);
+	}
+	closedir(dir);
+	sort(files.begin(), files.end());
+	return files;
+}
+
+// run fmp4ingest with the tracks against the receiver, returns the exit status.
+// the worker pool ends each track on its own and exits when all are done
+static int run_fmp4ingest(const string &fmp4ingest, int port, const string &metrics_file, const vector<string> &tracks, int workers)
+{
+	vector<string> args = { fmp4ingest, "-u", "http://127.0.0.1:" + to_string(port) + "/bench.isml", "--loop", "0",
+		"--workers", to_string(workers), "--metrics", metrics_file };
+	args.insert(args.end(), tracks.begin(), tracks.end());
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		// the per fragment logging of fmp4ingest is not part of the benchmark
+		int null_fd = open("/dev/null", O_WRONLY);
+		dup2(null_fd, 1);
+		dup2(null_fd, 2);
+
+		vector<char *> argv;
+		for (auto &a : args)
+			argv.push_back((char *)a.c_str());
+		argv.push_back(NULL);
+		execv(argv[0], &argv[0]);
+		_exit(127);
+	}
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static double get_children_cpu_seconds()
+{
+	rusage usage = {};
+	getrusage(RUSAGE_CHILDREN, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// throughput of the fragment box scan in GB/s, the bytes are sample data without
+// a valid box so the whole buffer is scanned before the moof at its end is found
+static int run_scan_bench(int scan_mb)
+{
+	const uint64_t size = (uint64_t)scan_mb << 20;
+	const uint8_t moof[] = { 0, 0, 0, 24, 'm', 'o', 'o', 'f', 0, 0, 0, 16, 'm', 'f', 'h', 'd', 0, 0, 0, 0, 0, 0, 0, 1 };
+	vector<uint8_t> data(size + sizeof(moof));
+	minstd_rand rnd(1);
+	for (uint64_t i = 0; i < size; i++)
+		data[i] = (uint8_t)rnd();
+	memcpy(&data[size], moof, sizeof(moof));
+
+	// random bytes can form a valid box header now and then, break those up
+	for (uint64_t pos = box_scan::find_fragment_box_scalar(&data[0], data.size()); pos < size; pos = box_scan::find_fragment_box_scalar(&data[0], data.size()))
+		data[pos + 4] ^= 0x80;
+
+	cout << "fragment box scan over " << scan_mb << " MB" << endl;
+	cout << setw(10) << "path" << setw(10) << "GB/s" << endl;
+
+	const char *paths[] = { box_scan::get_scan_path(), "scalar" };
+	for (int k = 0; k < 2; k++)
+	{
+		uint64_t found = 0;
+		double best = 0;
+		for (int run = 0; run < 5; run++)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			found = k == 0 ? box_scan::find_fragment_box(&data[0], data.size()) : box_scan::find_fragment_box_scalar(&data[0], data.size());
+			const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			best = max(best, size / elapsed / 1e9);
+		}
+
+		if (found != size)
+		{
+			cout << "the " << paths[k] << " scan found a box at " << found << " instead of " << size << endl;
+			return 1;
+		}
+		cout << setw(10) << paths[k] << fixed << setprecision(2) << setw(10) << best << endl;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	bench_options_t opts;
+	if (!opts.parse_options(argc, argv))
+		return 1;
+
+	if (opts.scan_mb_ > 0)
+		return run_scan_bench(opts.scan_mb_);
+
+	if (access(opts.fmp4ingest_.c_str(), X_OK) != 0)
+	{
+		cout << "fmp4ingest not found: " << opts.fmp4ingest_ << endl;
+		bench_options_t::print_options();
+		return 1;
+	}
+
+	const string video_track = "bench_video.cmfv";
+	const string metrics_file = "bench_metrics.prom";
+	const vector<string> test_tracks = get_text_tracks(opts.test_files_);
+
+	// a shorter track would leave the run with fewer tracks before it ends, so
+	// all tracks get the fragment count of the shortest one
+	int fragments = opts.fragments_;
+	for (auto &t : test_tracks)
+		fragments = min(fragments, count_fragments(t));
+
+	// the text tracks are copied here, the test files are not written to
+	vector<string> text_tracks;
+	for (auto &t : test_tracks)
+	{
+		const string name = "bench_" + t.substr(t.find_last_of('/') + 1);
+		if (!copy_track_head(t, name, fragments))
+		{
+			cout << "failed copying track: " << t << endl;
+			return 1;
+		}
+		text_tracks.push_back(name);
+	}
+
+	if (fragments <= 0 || !write_synthetic_track(video_track, opts.bitrate_, fragments))
+	{
+		cout << "failed writing synthetic track: " << video_track << endl;
+		return 1;
+	}
+
+	cout << "synthetic video tracks: " << opts.bitrate_ << " Mbit/s, text tracks: " << text_tracks.size() <<
+		", fragments per track: " << fragments << ", workers: " << opts.workers_ << endl;
+	cout << setw(8) << "tracks" << setw(14) << "fragments/s" << setw(10) << "MB/s" << setw(10) << "p50 ms" << setw(10) << "p99 ms" << setw(16) << "cpu ms/track" << endl;
+
+	vector<int> runs;
+	for (int n = 1; n < opts.max_tracks_; n *= 2)
+		runs.push_back(n);
+	runs.push_back(opts.max_tracks_);
+
+	int result = 0;
+	for (int n : runs)
+	{
+		// each track needs its own file name for its url
+		vector<string> tracks = text_tracks;
+		for (int k = 0; k < n; k++)
+		{
+			string name = "bench_video_" + to_string(k) + ".cmfv";
+			unlink(name.c_str());
+			if (symlink(video_track.c_str(), name.c_str()) != 0)
+			{
+				cout << "failed creating track: " << name << endl;
+				return 1;
+			}
+			tracks.push_back(name);
+		}
+
+		loopback_receiver_t receiver;
+		if (!receiver.start())
+		{
+			cout << "failed starting the loopback receiver" << endl;
+			return 1;
+		}
+
+		unlink(metrics_file.c_str());
+		const double cpu_start = get_children_cpu_seconds();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		const int status = run_fmp4ingest(opts.fmp4ingest_, receiver.port_, metrics_file, tracks, opts.workers_);
+		const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		const double cpu = get_children_cpu_seconds() - cpu_start;
+		receiver.stop();
+
+		if (status != 0)
+		{
+			cout << "fmp4ingest exited with status " << status << endl;
+			result = 1;
+		}
+
+		// a track that ended early would make the run faster than the push path is
+		const uint64_t expected = (uint64_t)fragments * tracks.size();
+		if (receiver.stats_.fragments_ != expected)
+		{
+			cout << "received " << receiver.stats_.fragments_ << " of " << expected << " fragments, the run does not count" << endl;
+			result = 1;
+		}
+		else
+		{
+			cout << fixed << setprecision(1) << setw(8) << tracks.size() <<
+				setw(14) << receiver.stats_.fragments_ / elapsed <<
+				setw(10) << receiver.stats_.bytes_ / elapsed / 1e6 <<
+				setprecision(2) << setw(10) << get_latency_quantile(metrics_file, 0.5) * 1000 <<
+				setw(10) << get_latency_quantile(metrics_file, 0.99) * 1000 <<
+				setw(16) << cpu * 1000 / tracks.size() << endl;
+		}
+
+		for (int k = 0; k < n; k++)
+			unlink(("bench_video_" + to_string(k) + ".cmfv").c_str());
+	}
+
+	for (auto &t : text_tracks)
+		unlink(t.c_str());
+	unlink(video_track.c_str());
+	unlink(metrics_file.c_str());
+	return result;
+}
@@ -0,0 +1,50 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+box types as the big endian 32 bit value of the box type field, the box
+walkers read the type once and compare integers instead of strings
+
+******************************************************************************/
+
+#ifndef FOURCC_H
+#define FOURCC_H
+
+#include <cstdint>
+
+namespace fourcc
+{
+	constexpr uint32_t make(const char (&s)[5])
+	{
+		return ((uint32_t)(uint8_t)s[0] << 24) | ((uint32_t)(uint8_t)s[1] << 16) | ((uint32_t)(uint8_t)s[2] << 8) | (uint32_t)(uint8_t)s[3];
+	}
+
+	// type of the box at data
+	inline uint32_t get_type(const uint8_t *box)
+	{
+		return ((uint32_t)box[4] << 24) | ((uint32_t)box[5] << 16) | ((uint32_t)box[6] << 8) | (uint32_t)box[7];
+	}
+
+	constexpr uint32_t ftyp = make("ftyp");
+	constexpr uint32_t moov = make("moov");
+	constexpr uint32_t trak = make("trak");
+	constexpr uint32_t mdia = make("mdia");
+	constexpr uint32_t mdhd = make("mdhd");
+	constexpr uint32_t mvex = make("mvex");
+	constexpr uint32_t trex = make("trex");
+	constexpr uint32_t styp = make("styp");
+	constexpr uint32_t prft = make("prft");
+	constexpr uint32_t emsg = make("emsg");
+	constexpr uint32_t moof = make("moof");
+	constexpr uint32_t mfhd = make("mfhd");
+	constexpr uint32_t traf = make("traf");
+	constexpr uint32_t tfhd = make("tfhd");
+	constexpr uint32_t tfdt = make("tfdt");
+	constexpr uint32_t trun = make("trun");
+	constexpr uint32_t mdat = make("mdat");
+}
+
+#endif
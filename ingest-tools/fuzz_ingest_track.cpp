@@ -0,0 +1,323 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+fuzz targets for the box parsers of the ingest tools, FUZZ_TARGET selects
+the entry point:
+
+load    track_store_t::load_from_file, then the samples, the patched
+        segments and the tfdt patch of every fragment
+index   track_store_t::load_index with the input as the index of a fixed
+        track, the size and time stamp are set to match so the entries
+        are reached
+reader  track_reader_t::read_segment until the end of the input
+scan    box_scan::find_fragment_box, compared with the scalar scan
+
+built with -fsanitize=fuzzer libFuzzer provides main, otherwise main runs
+the files and directories of a corpus (test_files) and reports the worst
+case parse time, --mutate runs mutations of each entry as well
+
+******************************************************************************/
+
+#include "box_scan.h"
+#include "ingest_track.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#ifndef FUZZ_TARGET_LOAD
+#ifndef FUZZ_TARGET_INDEX
+#ifndef FUZZ_TARGET_READER
+#ifndef FUZZ_TARGET_SCAN
+#define FUZZ_TARGET_LOAD
+#endif
+#endif
+#endif
+#endif
+
+using namespace std;
+using namespace ingest_track;
+
+// file the input is written to, the loaders read files
+static const string &get_input_name()
+{
+	static const string name = "fuzz_input_" + to_string(getpid()) + ".cmfv";
+	return name;
+}
+
+static bool write_file(const string &file_name, const uint8_t *data, size_t size)
+{
+	ofstream out(file_name, ios::binary | ios::trunc);
+	out.write((const char *)data, size);
+	return out.good();
+}
+
+#ifdef FUZZ_TARGET_INDEX
+static void write_32(vector<uint8_t> &out, uint32_t v)
+{
+	out.push_back((uint8_t)(v >> 24));
+	out.push_back((uint8_t)(v >> 16));
+	out.push_back((uint8_t)(v >> 8));
+	out.push_back((uint8_t)v);
+}
+
+static void write_box(vector<uint8_t> &out, const char *type, const vector<uint8_t> &payload)
+{
+	write_32(out, (uint32_t)(payload.size() + 8));
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), payload.begin(), payload.end());
+}
+
+// track of two fragments the fuzzed indexes refer to
+static const string &get_index_track()
+{
+	static string name;
+	if (name.size())
+		return name;
+
+	vector<uint8_t> out, mdhd, mdia, trak, trex, mvex, moov;
+	write_box(out, "ftyp", vector<uint8_t>({ 'c', 'm', 'f', 'c', 0, 0, 0, 0 }));
+	for (uint32_t v : { 0u, 0u, 0u, 1000u, 0u, 0x55c40000u })
+		write_32(mdhd, v);
+	write_box(mdia, "mdhd", mdhd);
+	write_box(trak, "mdia", mdia);
+	write_box(moov, "trak", trak);
+	for (uint32_t v : { 0u, 1u, 1u, 40u, 100u, 0x10000u })
+		write_32(trex, v);
+	write_box(mvex, "trex", trex);
+	write_box(moov, "mvex", mvex);
+	write_box(out, "moov", moov);
+
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		vector<uint8_t> mfhd, tfhd, tfdt, trun, traf, moof;
+		write_32(mfhd, 0);
+		write_32(mfhd, i + 1);
+		write_32(tfhd, 0x020000);
+		write_32(tfhd, 1);
+		write_32(tfdt, 0);
+		write_32(tfdt, i * 1000);
+		write_32(trun, 0x000004);
+		write_32(trun, 25);
+		write_32(trun, 0);
+		write_box(traf, "tfhd", tfhd);
+		write_box(traf, "tfdt", tfdt);
+		write_box(traf, "trun", trun);
+		write_box(moof, "mfhd", mfhd);
+		write_box(moof, "traf", traf);
+		write_box(out, "moof", moof);
+		write_box(out, "mdat", vector<uint8_t>(2500, 0));
+	}
+
+	name = "fuzz_track_" + to_string(getpid()) + ".cmfv";
+	write_file(name, &out[0], out.size());
+	return name;
+}
+#endif
+
+static void run_input(const uint8_t *data, size_t size)
+{
+#ifdef FUZZ_TARGET_LOAD
+	track_store_t s;
+	if (!write_file(get_input_name(), data, size) || !s.load_from_file(get_input_name()))
+		return;
+
+	vector<sample_entry_t> samples;
+	vector<uint8_t> buf;
+	for (size_t i = 0; i < s.fragments_.size(); i++)
+	{
+		s.get_samples(i, samples);
+		s.get_media_segment(i, 1ULL << 40, 1000, buf);
+	}
+	s.get_duration();
+#endif
+
+#ifdef FUZZ_TARGET_INDEX
+	// the stamp of the track in the header, so the entries are parsed
+	const string &track = get_index_track();
+	vector<uint8_t> idx(data, data + size);
+	uint64_t stamp[2] = { 0, 0 };
+	if (idx.size() >= 28 && get_file_stamp(track, stamp[0], stamp[1]))
+	{
+		for (int k = 0; k < 16; k++)
+			idx[12 + k] = (uint8_t)(stamp[k / 8] >> (56 - 8 * (k % 8)));
+	}
+
+	const string index_name = get_input_name() + ".fidx";
+	track_store_t s;
+	if (!s.map_.open(track) || !write_file(index_name, idx.data(), idx.size()) || !s.load_index(index_name))
+		return;
+
+	vector<sample_entry_t> samples;
+	vector<uint8_t> buf;
+	for (size_t i = 0; i < s.fragments_.size(); i++)
+	{
+		s.get_samples(i, samples);
+		s.get_media_segment(i, 1ULL << 40, 1000, buf);
+	}
+#endif
+
+#ifdef FUZZ_TARGET_READER
+	track_reader_t r;
+	if (!write_file(get_input_name(), data, size) || !r.open(get_input_name(), false, 0))
+		return;
+
+	vector<uint8_t> seg;
+	fragment_entry_t f;
+	r.time_offset_ = 1ULL << 40;
+	while (r.read_segment(seg, f) != end_of_input)
+		;
+#endif
+
+#ifdef FUZZ_TARGET_SCAN
+	if (box_scan::find_fragment_box(data, size) != box_scan::find_fragment_box_scalar(data, size))
+		abort();
+#endif
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	run_input(data, size);
+	return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+static void add_corpus_files(const string &path, vector<string> &files)
+{
+	DIR *dir = opendir(path.c_str());
+	if (!dir)
+	{
+		files.push_back(path);
+		return;
+	}
+
+	while (struct dirent *e = readdir(dir))
+	{
+		const string name = e->d_name;
+		if (name != "." && name != "..")
+			add_corpus_files(path + "/" + name, files);
+	}
+	closedir(dir);
+	sort(files.begin(), files.end());
+}
+
+// run an input and return its parse time in milli seconds
+static double time_input(const vector<uint8_t> &data)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	run_input(data.size() ? &data[0] : NULL, data.size());
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// damage the sizes, counts and flags the parsers trust
+static void mutate(vector<uint8_t> &data, minstd_rand &rnd)
+{
+	static const uint32_t values[] = { 0, 1, 7, 8, 0x7FFFFFFF, 0xFFFFFFFF, 0x01000000 };
+	if (data.size() < 4)
+		return;
+
+	for (int n = 1 + rnd() % 4; n > 0; n--)
+	{
+		const size_t pos = rnd() % (data.size() - 3);
+		if (rnd() % 2)
+		{
+			const uint32_t v = values[rnd() % (sizeof(values) / sizeof(values[0]))];
+			data[pos] = (uint8_t)(v >> 24);
+			data[pos + 1] = (uint8_t)(v >> 16);
+			data[pos + 2] = (uint8_t)(v >> 8);
+			data[pos + 3] = (uint8_t)v;
+		}
+		else
+		{
+			data[pos] ^= (uint8_t)(1 << (rnd() % 8));
+		}
+	}
+
+	if (rnd() % 4 == 0)
+		data.resize(rnd() % data.size());
+}
+
+int main(int argc, char *argv[])
+{
+	vector<string> files;
+	int mutations = 0;
+	double budget = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string t(argv[i]);
+		if (t.compare("--mutate") == 0 && i + 1 < argc) { mutations = atoi(argv[++i]); continue; }
+		if (t.compare("--budget") == 0 && i + 1 < argc) { budget = atof(argv[++i]); continue; }
+		add_corpus_files(t, files);
+	}
+
+#ifdef FUZZ_TARGET_INDEX
+	// the index of the fixed track reaches the fragment entries
+	track_store_t s;
+	if (files.size() && s.load_from_file(get_index_track(), true))
+		files.insert(files.begin(), get_index_name(get_index_track()));
+#endif
+
+	if (!files.size())
+	{
+		cout << "usage: " << argv[0] << " [--mutate runs] [--budget ms] <corpus files or directories>" << endl;
+		return 1;
+	}
+
+	minstd_rand rnd(1);
+	double worst = 0;
+	string worst_name;
+	int over_budget = 0;
+
+	for (const string &name : files)
+	{
+		ifstream in(name, ios::binary);
+		const vector<uint8_t> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+		double entry_worst = time_input(data);
+		for (int k = 0; k < mutations; k++)
+		{
+			vector<uint8_t> m = data;
+			mutate(m, rnd);
+			entry_worst = max(entry_worst, time_input(m));
+		}
+
+		cout << name << " worst parse time: " << entry_worst << " ms" << endl;
+		if (entry_worst > worst)
+		{
+			worst = entry_worst;
+			worst_name = name;
+		}
+		if (budget > 0 && entry_worst > budget)
+			over_budget++;
+	}
+
+	cout << "worst parse time: " << worst << " ms " << worst_name << endl;
+	unlink(get_input_name().c_str());
+	unlink((get_input_name() + ".fidx").c_str());
+#ifdef FUZZ_TARGET_INDEX
+	unlink(get_index_track().c_str());
+	unlink(get_index_name(get_index_track()).c_str());
+#endif
+
+	if (over_budget)
+	{
+		cout << over_budget << " corpus entries over the budget of " << budget << " ms" << endl;
+		return 1;
+	}
+	return 0;
+}
+#endif
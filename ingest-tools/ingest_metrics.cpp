@@ -0,0 +1,185 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+******************************************************************************/
+
+#include "ingest_metrics.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace ingest_metrics
+{
+	track_metrics_t::track_metrics_t(const std::string &track)
+		: track_(track)
+	{
+		memset(&counters_, 0, sizeof(counters_));
+	}
+
+	void track_metrics_t::post_done(double latency, uint64_t bytes, bool ok)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		size_t b = 0;
+		while (b < latency_bucket_count && latency > latency_buckets[b])
+			b++;
+
+		counters_.posts_++;
+		counters_.latency_counts_[b]++;
+		counters_.latency_sum_ += latency;
+		if (ok)
+			counters_.bytes_ += bytes;
+		else
+			counters_.post_errors_++;
+	}
+
+	void track_metrics_t::bytes_sent(uint64_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		counters_.bytes_ += bytes;
+	}
+
+	void track_metrics_t::retry_done()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		counters_.retries_++;
+	}
+
+	void track_metrics_t::fragment_sent(double media_time, double elapsed, double duration)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		counters_.fragments_++;
+		counters_.media_lag_ = elapsed - media_time;
+		if (counters_.media_lag_ > duration)
+			counters_.deadline_misses_++;
+	}
+
+	track_counters_t track_metrics_t::get_counters()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return counters_;
+	}
+
+	metrics_registry_t::metrics_registry_t()
+		: last_write_(std::chrono::steady_clock::now())
+	{
+	}
+
+	track_metrics_t *metrics_registry_t::add_track(const std::string &track)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tracks_.push_back(std::make_shared<track_metrics_t>(track));
+		last_bytes_.push_back(0);
+		return tracks_.back().get();
+	}
+
+	// label of a track with the characters escaped that the text format requires,
+	// without the closing brace so the histogram buckets can add their bound
+	static std::string get_label(const std::string &track)
+	{
+		std::string label = "{track=\"";
+		for (char c : track)
+		{
+			if (c == '\\' || c == '"')
+				label += '\\';
+			if (c == '\n')
+				label += "\\n";
+			else
+				label += c;
+		}
+		return label + "\"";
+	}
+
+	static void write_header(std::ostream &os, const char *name, const char *type, const char *help)
+	{
+		os << "# HELP " << name << " " << help << "\n";
+		os << "# TYPE " << name << " " << type << "\n";
+	}
+
+	void metrics_registry_t::write(std::ostream &os)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		const double interval = std::chrono::duration<double>(now - last_write_).count();
+		std::vector<track_counters_t> c(tracks_.size());
+		std::vector<std::string> labels(tracks_.size());
+
+		// samples of a metric are grouped, so take the counters of all tracks first
+		for (size_t i = 0; i < tracks_.size(); i++)
+		{
+			c[i] = tracks_[i]->get_counters();
+			labels[i] = get_label(tracks_[i]->track_);
+		}
+
+		write_header(os, "fmp4ingest_posts_total", "counter", "segment posts");
+		for (size_t i = 0; i < c.size(); i++)
+			os << "fmp4ingest_posts_total" << labels[i] << "} " << c[i].posts_ << "\n";
+
+		write_header(os, "fmp4ingest_post_errors_total", "counter", "segment posts that failed");
+		for (size_t i = 0; i < c.size(); i++)
+			os << "fmp4ingest_post_errors_total" << labels[i] << "} " << c[i].post_errors_ << "\n";
+
+		write_header(os, "fmp4ingest_retries_total", "counter", "resends of failed media segments");
+		for (size_t i = 0; i < c.size(); i++)
+			os << "fmp4ingest_retries_total" << labels[i] << "} " << c[i].retries_ << "\n";
+
+		write_header(os, "fmp4ingest_fragments_total", "counter", "media fragments sent");
+		for (size_t i = 0; i < c.size(); i++)
+			os << "fmp4ingest_fragments_total" << labels[i] << "} " << c[i].fragments_ << "\n";
+
+		write_header(os, "fmp4ingest_deadline_misses_total", "counter", "media fragments sent more than a fragment duration late");
+		for (size_t i = 0; i < c.size(); i++)
+			os << "fmp4ingest_deadline_misses_total" << labels[i] << "} " << c[i].deadline_misses_ << "\n";
+
+		write_header(os, "fmp4ingest_bytes_total", "counter", "bytes posted");
+		for (size_t i = 0; i < c.size(); i++)
+			os << "fmp4ingest_bytes_total" << labels[i] << "} " << c[i].bytes_ << "\n";
+
+		write_header(os, "fmp4ingest_throughput_bytes_per_second", "gauge", "bytes posted per second since the last write");
+		for (size_t i = 0; i < c.size(); i++)
+		{
+			os << "fmp4ingest_throughput_bytes_per_second" << labels[i] << "} " <<
+				(interval > 0 ? (double)(c[i].bytes_ - last_bytes_[i]) / interval : 0.0) << "\n";
+			last_bytes_[i] = c[i].bytes_;
+		}
+
+		write_header(os, "fmp4ingest_media_lag_seconds", "gauge", "wallclock minus media time of the last fragment sent");
+		for (size_t i = 0; i < c.size(); i++)
+			os << "fmp4ingest_media_lag_seconds" << labels[i] << "} " << c[i].media_lag_ << "\n";
+
+		write_header(os, "fmp4ingest_post_latency_seconds", "histogram", "latency of the segment posts");
+		for (size_t i = 0; i < c.size(); i++)
+		{
+			uint64_t count = 0;
+			for (size_t b = 0; b <= latency_bucket_count; b++)
+			{
+				count += c[i].latency_counts_[b];
+				os << "fmp4ingest_post_latency_seconds_bucket" << labels[i] << ",le=\"";
+				if (b < latency_bucket_count)
+					os << latency_buckets[b];
+				else
+					os << "+Inf";
+				os << "\"} " << count << "\n";
+			}
+			os << "fmp4ingest_post_latency_seconds_sum" << labels[i] << "} " << c[i].latency_sum_ << "\n";
+			os << "fmp4ingest_post_latency_seconds_count" << labels[i] << "} " << count << "\n";
+		}
+
+		last_write_ = now;
+	}
+
+	bool metrics_registry_t::write_file(const std::string &file_name)
+	{
+		const std::string tmp_name = file_name + ".tmp";
+		std::ofstream out(tmp_name);
+		if (!out.good())
+			return false;
+
+		write(out);
+		out.close();
+		return std::rename(tmp_name.c_str(), file_name.c_str()) == 0;
+	}
+}
@@ -0,0 +1,91 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+per track ingest metrics, written in the prometheus text format to a file
+that a scraper (node exporter textfile collector) or a script can read
+
+******************************************************************************/
+
+#ifndef INGEST_METRICS_H
+#define INGEST_METRICS_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace ingest_metrics
+{
+	// upper bounds of the post latency histogram buckets in seconds
+	const double latency_buckets[] = { 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0 };
+	const size_t latency_bucket_count = sizeof(latency_buckets) / sizeof(latency_buckets[0]);
+
+	// counters of a track
+	struct track_counters_t
+	{
+		uint64_t posts_;
+		uint64_t post_errors_;
+		uint64_t bytes_;
+		uint64_t retries_;
+		uint64_t fragments_;
+		uint64_t deadline_misses_;
+		uint64_t latency_counts_[latency_bucket_count + 1]; // per bucket, the last one is +Inf
+		double latency_sum_;
+		double media_lag_; // wallclock minus media time of the last fragment in seconds
+	};
+
+	// metrics of a track, updated by its sender and read by the writer
+	struct track_metrics_t
+	{
+		explicit track_metrics_t(const std::string &track);
+
+		// a post of bytes finished after latency seconds
+		void post_done(double latency, uint64_t bytes, bool ok);
+
+		// bytes were written to a long running post
+		void bytes_sent(uint64_t bytes);
+
+		// a failed segment was resent
+		void retry_done();
+
+		// a fragment of duration seconds with a media time of media_time seconds was
+		// sent elapsed seconds after the media timeline was started, it missed its
+		// deadline when it went out more than a fragment duration late
+		void fragment_sent(double media_time, double elapsed, double duration);
+
+		track_counters_t get_counters();
+
+		std::string track_;
+		std::mutex mutex_;
+		track_counters_t counters_;
+	};
+
+	// metrics of all tracks of the process
+	struct metrics_registry_t
+	{
+		metrics_registry_t();
+
+		// metrics of a track, owned by the registry
+		track_metrics_t *add_track(const std::string &track);
+
+		// write all tracks in the prometheus text format
+		void write(std::ostream &os);
+
+		// write to a temporary file and rename it, so a reader never sees a partial file
+		bool write_file(const std::string &file_name);
+
+		std::mutex mutex_;
+		std::vector<std::shared_ptr<track_metrics_t> > tracks_;
+		std::vector<uint64_t> last_bytes_; // bytes of each track at the last write
+		std::chrono::steady_clock::time_point last_write_;
+	};
+}
+
+#endif
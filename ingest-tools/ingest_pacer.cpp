@@ -0,0 +1,113 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+******************************************************************************/
+
+#include "ingest_pacer.h"
+
+namespace ingest_pacer
+{
+	std::chrono::nanoseconds ticks_to_duration(uint64_t ticks, uint32_t timescale)
+	{
+		if (!timescale)
+			return std::chrono::nanoseconds(0);
+
+		// whole seconds and the remainder, ticks * 1e9 overflows after a few days at 90 kHz
+		const uint64_t seconds = ticks / timescale;
+		const uint64_t rest = ticks % timescale;
+		return std::chrono::nanoseconds((int64_t)(seconds * 1000000000ULL + rest * 1000000000ULL / timescale));
+	}
+
+	media_clock_t::media_clock_t()
+		: start_(std::chrono::steady_clock::now())
+	{
+	}
+
+	media_clock_t::media_clock_t(std::chrono::steady_clock::time_point start)
+		: start_(start)
+	{
+	}
+
+	std::chrono::steady_clock::time_point media_clock_t::get_deadline(uint64_t ticks, uint32_t timescale) const
+	{
+		return start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(ticks_to_duration(ticks, timescale));
+	}
+
+	double media_clock_t::get_elapsed(std::chrono::steady_clock::time_point now) const
+	{
+		return std::chrono::duration<double>(now - start_).count();
+	}
+
+	deadline_queue_t::deadline_queue_t()
+		: pushed_(0)
+		, closed_(false)
+	{
+	}
+
+	void deadline_queue_t::push(size_t id, std::chrono::steady_clock::time_point deadline)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		entry_t e = { deadline, pushed_++, id };
+		heap_.push(e);
+
+		// a worker waits for the earliest deadline, it may be this one now
+		changed_.notify_one();
+	}
+
+	bool deadline_queue_t::pop_due(size_t &id)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (!closed_)
+		{
+			if (heap_.empty())
+			{
+				changed_.wait(lock);
+				continue;
+			}
+
+			const std::chrono::steady_clock::time_point deadline = heap_.top().deadline_;
+			if (deadline > std::chrono::steady_clock::now())
+			{
+				changed_.wait_until(lock, deadline);
+				continue;
+			}
+
+			id = heap_.top().id_;
+			heap_.pop();
+
+			// the next entry needs a waiting worker of its own
+			if (!heap_.empty())
+				changed_.notify_one();
+			return true;
+		}
+		return false;
+	}
+
+	void deadline_queue_t::close()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		closed_ = true;
+		changed_.notify_all();
+	}
+
+	void run_worker(deadline_queue_t &queue, std::atomic<size_t> &active, const send_function_t &send)
+	{
+		size_t id;
+		while (queue.pop_due(id))
+		{
+			std::chrono::steady_clock::time_point next;
+			if (send(id, next))
+			{
+				queue.push(id, next);
+				continue;
+			}
+
+			if (--active == 0)
+				queue.close();
+		}
+	}
+}
@@ -0,0 +1,95 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+realtime pacing of the media timeline, send deadlines are absolute time
+points on the steady clock computed from the media time of a fragment, so
+errors of a wake up do not add up and steps of the wall clock (ntp) do not
+disturb the pacing. the deadline queue holds the deadlines of all tracks of
+the process for a pool of worker threads, each worker runs the dispatch loop
+
+******************************************************************************/
+
+#ifndef INGEST_PACER_H
+#define INGEST_PACER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+namespace ingest_pacer
+{
+	// duration of ticks in timescale, converted exactly in integers so long
+	// runs do not drift by rounding
+	std::chrono::nanoseconds ticks_to_duration(uint64_t ticks, uint32_t timescale);
+
+	// clock of a media timeline, media time 0 is due at start_ and the loops
+	// continue on it, it is never restarted
+	struct media_clock_t
+	{
+		media_clock_t();
+		explicit media_clock_t(std::chrono::steady_clock::time_point start);
+
+		// time point media time ticks in timescale is due
+		std::chrono::steady_clock::time_point get_deadline(uint64_t ticks, uint32_t timescale) const;
+
+		// seconds since the start of the timeline
+		double get_elapsed(std::chrono::steady_clock::time_point now) const;
+
+		std::chrono::steady_clock::time_point start_;
+	};
+
+	// deadlines of many tracks in a min heap, worker threads take the track that
+	// is due first. a track is in the queue at most once, so only one worker
+	// sends for it at a time
+	struct deadline_queue_t
+	{
+		deadline_queue_t();
+
+		// add track id, due at deadline
+		void push(size_t id, std::chrono::steady_clock::time_point deadline);
+
+		// wait until the earliest track is due and take it, false when closed
+		bool pop_due(size_t &id);
+
+		// wake the waiting workers, pop_due returns false from then on
+		void close();
+
+		struct entry_t
+		{
+			std::chrono::steady_clock::time_point deadline_;
+			uint64_t order_; // tracks with the same deadline are taken in push order
+			size_t id_;
+
+			bool operator>(const entry_t &e) const
+			{
+				return deadline_ != e.deadline_ ? deadline_ > e.deadline_ : order_ > e.order_;
+			}
+		};
+
+		std::mutex mutex_;
+		std::condition_variable changed_;
+		std::priority_queue<entry_t, std::vector<entry_t>, std::greater<entry_t> > heap_;
+		uint64_t pushed_;
+		bool closed_;
+	};
+
+	// sends the next segment of track id, false when the track is done, otherwise
+	// next is set to the time point the track is due again
+	typedef std::function<bool(size_t id, std::chrono::steady_clock::time_point &next)> send_function_t;
+
+	// dispatch loop of a worker thread, takes the tracks that are due from queue
+	// and calls send for them. active counts the tracks that are not done, the
+	// queue is closed when the last one is done so all workers return
+	void run_worker(deadline_queue_t &queue, std::atomic<size_t> &active, const send_function_t &send);
+}
+
+#endif
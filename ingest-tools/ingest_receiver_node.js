@@ -9,14 +9,22 @@
 ///////////////////////////////////////////
  
 const http = require('http')
+const http2 = require('http2')
 var fs = require('fs');
 var url = require('url');
 
-var boxes = ["ftyp","moov","moof","styp","emsg","prft"];
+// box types as the 32 bit big endian value of the type field
+function fourcc(s) { return ((s.charCodeAt(0) << 24) | (s.charCodeAt(1) << 16) | (s.charCodeAt(2) << 8) | s.charCodeAt(3)) >>> 0 }
+const init_boxes = new Set([fourcc("ftyp"), fourcc("moov")])
+const fragment_boxes = new Set([fourcc("moof"), fourcc("styp"), fourcc("emsg"), fourcc("prft"), fourcc("mfra")]) // mfra ends the stream
 
 var active_streams = new Map()
 
-const server = http.createServer(function(request, response) {
+// node ingest_receiver_node.js --h2c accepts HTTP/2 with prior knowledge (fmp4ingest --http2)
+const use_h2c = process.argv.includes('--h2c')
+const createServer = use_h2c ? http2.createServer : http.createServer
+
+const server = createServer(function(request, response) {
   console.dir(request.param)
 
   request.setEncoding('Binary')
@@ -48,17 +56,16 @@ const server = http.createServer(function(request, response) {
 	// end the node.js javascript
      request.on('end', function() 
 	{
-	var box = ""
-	var is_frag = new Boolean(false); 
-	var is_init = new Boolean(false);
+	var is_frag = false
+	var is_init = false
 	let binary = Buffer.concat(chunks);
 	
-	if(binary.length > 8)
+	if(binary.length >= 8)
 	{
-	  box = binary.slice(4,8)
+	  const box = binary.readUInt32BE(4)
 	 
-	  is_frag = new Boolean((box == boxes[2]) ||(box == boxes[3]) || (box == boxes[4]) || (box == boxes[5]) || (box == boxes[6]))
-	  is_init = new Boolean((box == boxes[0]) || (box == boxes[1]) )
+	  is_frag = fragment_boxes.has(box)
+	  is_init = init_boxes.has(box)
 	  
 	}
     
@@ -103,6 +110,11 @@ const server = http.createServer(function(request, response) {
 			response.writeHead(200, {'Content-Type': 'text/html'})
             response.end('duplicate CMAF Header or init fragment received')	
 		}
+		else // not a CMAF Header or fragment
+		{
+			response.writeHead(400, {'Content-Type': 'text/html'})
+            response.end('not a CMAF Header or media fragment')
+		}
 	}   
     });
    }  
@@ -119,4 +131,4 @@ const server = http.createServer(function(request, response) {
 const port = 8080
 const host = '127.0.0.1'
 server.listen(port, host)
-console.log(`Listening at http://${host}:${port}`)
+console.log(`Listening at http://${host}:${port}` + (use_h2c ? ' (h2c)' : ''))
@@ -0,0 +1,168 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+******************************************************************************/
+
+#include "ingest_schedule.h"
+#include <iostream>
+
+namespace ingest_schedule
+{
+	loop_timeline_t::loop_timeline_t()
+		: track_(NULL)
+		, base_(0)
+		, duration_(0)
+	{
+	}
+
+	loop_timeline_t::loop_timeline_t(const ingest_track::track_store_t &track, double presentation_duration, uint64_t base)
+		: track_(&track)
+		, base_(base)
+		, duration_((uint64_t)(presentation_duration * track.timescale_ + 0.5))
+	{
+	}
+
+	uint64_t loop_timeline_t::get_offset(uint64_t loop) const
+	{
+		return base_ + loop * duration_;
+	}
+
+	uint64_t loop_timeline_t::get_decode_time(uint64_t fnumber, uint64_t loop) const
+	{
+		return track_->fragments_[fnumber].base_media_decode_time_ + get_offset(loop);
+	}
+
+	ingest_track::segment_view_t loop_timeline_t::get_segment(uint64_t fnumber, uint64_t loop, std::vector<uint8_t> &buf) const
+	{
+		return track_->get_media_segment((size_t)fnumber, get_offset(loop),
+			(uint32_t)(loop * track_->fragments_.size()), buf);
+	}
+
+	uint64_t loop_timeline_t::get_media_ticks(uint64_t fnumber, uint64_t loop) const
+	{
+		return track_->fragments_[fnumber].base_media_decode_time_ - track_->get_start_time() + loop * duration_;
+	}
+
+	double loop_timeline_t::get_media_time(uint64_t fnumber, uint64_t loop) const
+	{
+		return (double)get_media_ticks(fnumber, loop) / track_->timescale_;
+	}
+
+	std::chrono::steady_clock::time_point loop_timeline_t::get_deadline(const ingest_pacer::media_clock_t &clock, uint64_t fnumber, uint64_t loop) const
+	{
+		return clock.get_deadline(get_media_ticks(fnumber, loop), track_->timescale_);
+	}
+
+	retry_queue_t::retry_queue_t()
+		: resend_init_(false)
+		, rng_(std::random_device()())
+	{
+	}
+
+	void retry_queue_t::push(uint64_t fnumber, uint64_t loop, uint64_t window_ms)
+	{
+		if (!window_ms)
+			return;
+
+		retry_entry_t e = {};
+		e.fnumber_ = fnumber;
+		e.loop_ = loop;
+		e.next_try_ = std::chrono::steady_clock::now() + backoff(0);
+		e.deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(window_ms);
+		queue_.push_back(e);
+	}
+
+	retry_entry_t *retry_queue_t::get_due(std::chrono::steady_clock::time_point now)
+	{
+		while (queue_.size() && queue_.front().deadline_ <= now)
+		{
+			std::cout << " dropped media fragment: " << queue_.front().fnumber_ << " retry window expired" << std::endl;
+			queue_.pop_front();
+		}
+
+		if (!queue_.size() || queue_.front().next_try_ > now)
+			return NULL;
+
+		return &queue_.front();
+	}
+
+	void retry_queue_t::failed()
+	{
+		retry_entry_t &e = queue_.front();
+		e.next_try_ = std::chrono::steady_clock::now() + backoff(++e.attempts_);
+		resend_init_ = true;
+	}
+
+	void retry_queue_t::done()
+	{
+		queue_.pop_front();
+	}
+
+	std::chrono::steady_clock::time_point retry_queue_t::next_try() const
+	{
+		return queue_.size() ? queue_.front().next_try_ : std::chrono::steady_clock::time_point::max();
+	}
+
+	std::chrono::milliseconds retry_queue_t::backoff(int attempts)
+	{
+		const int64_t ms = (int64_t)300 << (attempts < 4 ? attempts : 4);
+		std::uniform_int_distribution<int64_t> jitter(0, ms / 2);
+		return std::chrono::milliseconds(ms + jitter(rng_));
+	}
+
+	track_schedule_t::track_schedule_t()
+		: close_(true)
+		, init_done_(false)
+		, closing_(false)
+		, retrying_(false)
+		, draining_(false)
+		, is_done_(false)
+	{
+	}
+
+	bool track_schedule_t::get_due(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point &next)
+	{
+		if (init_done_ && !closing_)
+		{
+			if (retries_.get_due(now) && (deadline_ > now || draining_))
+			{
+				retrying_ = true;
+				return true;
+			}
+
+			if (draining_ && retries_.empty())
+			{
+				draining_ = false;
+				end();
+				if (is_done_)
+					return false;
+			}
+
+			if (retries_.next_try() < next)
+				next = retries_.next_try();
+
+			if (draining_)
+				return false;
+		}
+
+		if (deadline_ > now)
+		{
+			if (deadline_ < next)
+				next = deadline_;
+			return false;
+		}
+		return true;
+	}
+
+	void track_schedule_t::end()
+	{
+		if (close_)
+			closing_ = true;
+		else
+			is_done_ = true;
+	}
+}
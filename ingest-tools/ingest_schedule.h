@@ -0,0 +1,132 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+what a sender posts next and when, kept apart from the curl handles so the
+senders of fmp4ingest share it and it can be tested without a network. the
+loop timeline gives the decode time and deadline of each fragment of a looped
+track, the retry queue holds the failed media segments of a track and the
+track schedule picks the next request of a track from both
+
+******************************************************************************/
+
+#ifndef INGEST_SCHEDULE_H
+#define INGEST_SCHEDULE_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <vector>
+#include "ingest_pacer.h"
+#include "ingest_track.h"
+
+namespace ingest_schedule
+{
+	// virtual timeline of a looped track, fragment fnumber of loop number loop is
+	// sent with decode time tfdt + base + loop * presentation duration and its
+	// sequence number continued from the loops before. both are patched in a copy
+	// at send time, the loaded track is never modified and shared by all senders
+	struct loop_timeline_t
+	{
+		loop_timeline_t();
+
+		// presentation_duration in seconds, rounded to the track timescale
+		loop_timeline_t(const ingest_track::track_store_t &track, double presentation_duration, uint64_t base);
+
+		// offset of the decode times in loop number loop
+		uint64_t get_offset(uint64_t loop) const;
+
+		// decode time of fragment fnumber as sent in loop number loop
+		uint64_t get_decode_time(uint64_t fnumber, uint64_t loop) const;
+
+		// media segment of fragment fnumber as sent in loop number loop
+		ingest_track::segment_view_t get_segment(uint64_t fnumber, uint64_t loop, std::vector<uint8_t> &buf) const;
+
+		// media time in the timescale from the start of the first loop to fragment
+		// fnumber of loop number loop, the pacing runs on this timeline so the loops
+		// need no restart
+		uint64_t get_media_ticks(uint64_t fnumber, uint64_t loop) const;
+
+		// media time in seconds
+		double get_media_time(uint64_t fnumber, uint64_t loop) const;
+
+		// time point fragment fnumber of loop number loop is due on clock
+		std::chrono::steady_clock::time_point get_deadline(const ingest_pacer::media_clock_t &clock, uint64_t fnumber, uint64_t loop) const;
+
+		const ingest_track::track_store_t *track_; // the track, owned by main
+		uint64_t base_; // offset of the first loop, the wall clock offset
+		uint64_t duration_; // cmaf presentation duration in the track timescale
+	};
+
+	// a failed media segment waiting to be posted again
+	struct retry_entry_t
+	{
+		uint64_t fnumber_; // fragment number
+		uint64_t loop_; // loop the fragment was sent in
+		int attempts_; // resends that failed
+		std::chrono::steady_clock::time_point next_try_; // time point of the next resend
+		std::chrono::steady_clock::time_point deadline_; // the segment is dropped when not sent before
+	};
+
+	// retransmission queue of a track, the failed segments are resent in order
+	// with exponential backoff and jitter in the slack between the live segments
+	struct retry_queue_t
+	{
+		retry_queue_t();
+
+		// add a failed segment, it is dropped when not resent within window_ms, a
+		// window of 0 disables the resends
+		void push(uint64_t fnumber, uint64_t loop, uint64_t window_ms);
+
+		// first entry if it is due, entries past their deadline are dropped
+		retry_entry_t *get_due(std::chrono::steady_clock::time_point now);
+
+		// the resend of the first entry failed, try again after the backoff
+		void failed();
+
+		// the first entry was sent
+		void done();
+
+		bool empty() const { return queue_.empty(); }
+
+		// time point of the next resend, max when the queue is empty
+		std::chrono::steady_clock::time_point next_try() const;
+
+		// 300 ms doubled for every failed attempt up to 4.8 seconds, plus up to 50% jitter
+		// so tracks that failed together do not all retry at the same time
+		std::chrono::milliseconds backoff(int attempts);
+
+		bool resend_init_; // the init segment is posted before the next media segment
+		std::deque<retry_entry_t> queue_;
+		std::minstd_rand rng_;
+	};
+
+	// what a track sends next, the live segment at its deadline or a failed one
+	// from the retry queue in the slack before it
+	struct track_schedule_t
+	{
+		track_schedule_t();
+
+		// true when a request is due at now, retrying_ is set when it is a resend.
+		// otherwise next is lowered to the time point the track is due
+		bool get_due(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point &next);
+
+		// all fragments were sent, post the mfra or stop
+		void end();
+
+		bool close_; // the mfra is posted after the last fragment
+		bool init_done_; // the init segment was sent
+		bool closing_; // the mfra post is in flight
+		bool retrying_; // the request in flight is a resend of the first entry in retries_
+		bool draining_; // all fragments were sent, only the resends are left
+		bool is_done_;
+		retry_queue_t retries_; // failed media segments waiting to be resent
+		std::chrono::steady_clock::time_point deadline_; // time point the next live request is due
+	};
+}
+
+#endif
@@ -0,0 +1,1037 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+******************************************************************************/
+
+#include "ingest_track.h"
+#include "box_scan.h"
+#include "fourcc.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <thread>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace ingest_track
+{
+	static uint32_t read_32(const uint8_t *p)
+	{
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+	}
+
+	static void write_32(uint8_t *p, uint32_t v)
+	{
+		p[0] = (uint8_t)(v >> 24);
+		p[1] = (uint8_t)(v >> 16);
+		p[2] = (uint8_t)(v >> 8);
+		p[3] = (uint8_t)v;
+	}
+
+	static uint64_t read_64(const uint8_t *p)
+	{
+		return ((uint64_t)read_32(p) << 32) | read_32(p + 4);
+	}
+
+	static void write_64(uint8_t *p, uint64_t v)
+	{
+		write_32(p, (uint32_t)(v >> 32));
+		write_32(p + 4, (uint32_t)v);
+	}
+
+	// header length of the box at data, 16 when a 64 bit largesize follows the type
+	static uint64_t read_header_size(const uint8_t *data)
+	{
+		return read_32(data) == 1 ? 16 : 8;
+	}
+
+	// size of the box at data including the header, 0 if it does not fit in size bytes
+	static uint64_t read_box_size(const uint8_t *data, uint64_t size)
+	{
+		if (size < 8)
+			return 0;
+
+		uint64_t box_size = read_32(data);
+		if (box_size == 1)
+			box_size = size < 16 ? 0 : ((uint64_t)read_32(data + 8) << 32) | read_32(data + 12);
+		else if (box_size == 0)
+			box_size = size; // box extends to the end of the file
+
+		if (box_size < read_header_size(data) || box_size > size)
+			return 0;
+
+		return box_size;
+	}
+
+	// number of moof boxes at the top level, only the box headers are read. it stops
+	// at a damaged size, the fragments after it are added by growing the vector
+	static size_t count_fragments(const uint8_t *data, uint64_t size)
+	{
+		size_t count = 0;
+		uint64_t pos = 0;
+		while (pos + 8 <= size)
+		{
+			const uint64_t box_size = read_box_size(data + pos, size - pos);
+			if (!box_size)
+				break;
+
+			if (fourcc::get_type(data + pos) == fourcc::moof)
+				count++;
+			pos += box_size;
+		}
+		return count;
+	}
+
+	// offset of the first child box of type in [data, data + size), size if not found
+	static uint64_t find_box(const uint8_t *data, uint64_t size, uint32_t type)
+	{
+		uint64_t pos = 0;
+		while (pos + 8 <= size)
+		{
+			uint64_t box_size = read_box_size(data + pos, size - pos);
+			if (!box_size)
+				break;
+
+			if (fourcc::get_type(data + pos) == type)
+				return pos;
+
+			pos += box_size;
+		}
+		return size;
+	}
+
+	// payload of the child box at the end of a path like { mdia, mdhd }, NULL if not found
+	static const uint8_t *find_payload(const uint8_t *data, uint64_t size, std::initializer_list<uint32_t> path, uint64_t &payload_size)
+	{
+		for (uint32_t type : path)
+		{
+			uint64_t pos = find_box(data, size, type);
+			if (pos == size)
+				return NULL;
+
+			const uint64_t header = read_header_size(data + pos);
+			size = read_box_size(data + pos, size - pos) - header;
+			data += pos + header;
+		}
+		payload_size = size;
+		return data;
+	}
+
+	uint64_t find_tfdt_offset(const uint8_t *data, uint64_t size)
+	{
+		uint64_t moof = find_box(data, size, fourcc::moof);
+		if (moof == size)
+			return 0;
+
+		uint64_t payload_size = 0;
+		const uint64_t header = read_header_size(data + moof);
+		const uint8_t *tfdt = find_payload(data + moof + header, read_box_size(data + moof, size - moof) - header, { fourcc::traf, fourcc::tfdt }, payload_size);
+
+		// the decode time is 32 bits in version 0 and 64 bits in version 1
+		if (!tfdt || payload_size < 8 || (tfdt[0] == 1 && payload_size < 12))
+			return 0;
+
+		// 8 bytes before the payload, so the version is at offset 8 with either header
+		return tfdt - 8 - data;
+	}
+
+	// timescale of the first track in the moov payload
+	static uint32_t parse_timescale(const uint8_t *moov, uint64_t size)
+	{
+		uint64_t mdhd_size = 0;
+		const uint8_t *mdhd = find_payload(moov, size, { fourcc::trak, fourcc::mdia, fourcc::mdhd }, mdhd_size);
+		if (!mdhd || mdhd_size < 24)
+			return 0;
+
+		// version 1 has 64 bit creation and modification times
+		return mdhd[0] == 1 ? read_32(mdhd + 20) : read_32(mdhd + 12);
+	}
+
+	// default sample duration, flags and optionally size from the trex box in the moov payload
+	static void parse_trex(const uint8_t *moov, uint64_t size, uint32_t &default_duration, uint32_t &default_flags, uint32_t *default_size = NULL)
+	{
+		uint64_t trex_size = 0;
+		const uint8_t *trex = find_payload(moov, size, { fourcc::mvex, fourcc::trex }, trex_size);
+		default_duration = trex && trex_size >= 16 ? read_32(trex + 12) : 0;
+		default_flags = trex && trex_size >= 24 ? read_32(trex + 20) : 0;
+		if (default_size)
+			*default_size = trex && trex_size >= 20 ? read_32(trex + 16) : 0;
+	}
+
+	// sum of the sample durations of the trun boxes in a traf payload and
+	// whether the first sample is a sync sample, with samples all samples up
+	// to max_samples, a trun without sample fields is limited by its count only
+	static void parse_traf(const uint8_t *traf, uint64_t size, uint32_t default_duration, uint32_t default_flags, fragment_entry_t &f,
+		std::vector<sample_entry_t> *samples = NULL, uint32_t default_size = 0, uint64_t max_samples = 0)
+	{
+		uint64_t pos = 0;
+		bool first_trun = true;
+
+		f.duration_ = 0;
+		f.sync_ = 1;
+
+		while (pos + 8 <= size)
+		{
+			const uint64_t box_size = read_box_size(traf + pos, size - pos);
+			if (!box_size)
+				break;
+
+			const uint8_t *p = traf + pos + read_header_size(traf + pos);
+			const uint64_t payload_size = box_size - read_header_size(traf + pos);
+			const uint32_t flags = payload_size >= 4 ? read_32(p) & 0xFFFFFF : 0;
+
+			if (fourcc::get_type(traf + pos) == fourcc::tfhd && payload_size >= 8)
+			{
+				// track_ID then the optional fields in flag order
+				uint64_t off = 8;
+				off += flags & 0x01 ? 8 : 0; // base data offset
+				off += flags & 0x02 ? 4 : 0; // sample description index
+				if ((flags & 0x08) && off + 4 <= payload_size)
+					default_duration = read_32(p + off);
+				off += flags & 0x08 ? 4 : 0;
+				if ((flags & 0x10) && off + 4 <= payload_size)
+					default_size = read_32(p + off);
+				off += flags & 0x10 ? 4 : 0;
+				if ((flags & 0x20) && off + 4 <= payload_size)
+					default_flags = read_32(p + off);
+			}
+			else if (fourcc::get_type(traf + pos) == fourcc::trun && payload_size >= 8)
+			{
+				const uint32_t sample_count = read_32(p + 4);
+				uint64_t off = 8;
+				off += flags & 0x01 ? 4 : 0; // data offset
+				uint32_t first_flags = default_flags;
+				if ((flags & 0x04) && off + 4 <= payload_size)
+					first_flags = read_32(p + off);
+				off += flags & 0x04 ? 4 : 0;
+
+				const uint64_t entry_size = (flags & 0x100 ? 4 : 0) + (flags & 0x200 ? 4 : 0) + (flags & 0x400 ? 4 : 0) + (flags & 0x800 ? 4 : 0);
+				const uint64_t flags_off = off + (flags & 0x100 ? 4 : 0) + (flags & 0x200 ? 4 : 0);
+				if (!(flags & 0x04) && (flags & 0x400) && sample_count && flags_off + 4 <= payload_size)
+					first_flags = read_32(p + flags_off);
+
+				if (first_trun && sample_count)
+				{
+					f.sync_ = (first_flags & 0x10000) ? 0 : 1; // sample_is_non_sync_sample
+					first_trun = false;
+				}
+
+				if (!samples && !(flags & 0x100))
+				{
+					f.duration_ += (uint64_t)sample_count * default_duration;
+				}
+				else
+				{
+					// the fields of each sample in flag order, absent fields take the defaults
+					for (uint32_t i = 0; i < sample_count && off + entry_size <= payload_size; i++, off += entry_size)
+					{
+						if (samples && samples->size() >= max_samples)
+							break;
+
+						uint64_t field = off;
+						sample_entry_t e = {};
+						e.duration_ = flags & 0x100 ? read_32(p + field) : default_duration;
+						field += flags & 0x100 ? 4 : 0;
+						e.size_ = flags & 0x200 ? read_32(p + field) : default_size;
+						field += flags & 0x200 ? 4 : 0;
+						e.flags_ = flags & 0x400 ? read_32(p + field) : (i == 0 && (flags & 0x04) ? first_flags : default_flags);
+						field += flags & 0x400 ? 4 : 0;
+						e.composition_time_offset_ = flags & 0x800 ? read_32(p + field) : 0;
+
+						f.duration_ += e.duration_;
+						if (samples)
+							samples->push_back(e);
+					}
+				}
+			}
+			pos += box_size;
+		}
+	}
+
+	// timing of the moof box at moof_offset in the track bytes
+	static void parse_moof(const uint8_t *moof, uint64_t size, uint64_t moof_offset, uint32_t default_duration, uint32_t default_flags, fragment_entry_t &f)
+	{
+		uint64_t payload_size = 0;
+		const uint64_t header = read_header_size(moof);
+		const uint8_t *mfhd = find_payload(moof + header, size - header, { fourcc::mfhd }, payload_size);
+		if (mfhd && payload_size >= 8)
+		{
+			f.sequence_number_ = read_32(mfhd + 4);
+			f.mfhd_offset_ = moof_offset + (mfhd - 8 - moof);
+		}
+
+		const uint8_t *traf = find_payload(moof + header, size - header, { fourcc::traf }, payload_size);
+		if (traf)
+			parse_traf(traf, payload_size, default_duration, default_flags, f);
+
+		const uint64_t tfdt = find_tfdt_offset(moof, size);
+		if (tfdt)
+		{
+			const uint8_t *p = moof + tfdt;
+			f.tfdt_offset_ = moof_offset + tfdt;
+			f.tfdt_version_ = p[8];
+			f.base_media_decode_time_ = f.tfdt_version_ == 1 ?
+				((uint64_t)read_32(p + 12) << 32) | read_32(p + 16) : read_32(p + 12);
+		}
+	}
+
+	bool track_store_t::load_from_file(const std::string &file_name, bool use_index)
+	{
+		data_.clear();
+		init_size_ = 0;
+		timescale_ = 0;
+		fragments_.clear();
+
+		if (!map_.open(file_name))
+			return false;
+
+		const std::string index_name = get_index_name(file_name);
+		if (use_index && load_index(index_name))
+			return true;
+
+		const uint8_t *d = map_.data();
+		const uint64_t size = map_.size();
+		uint32_t default_duration = 0;
+		uint32_t default_flags = 0;
+		uint64_t pos = 0;
+		fragment_entry_t f = {};
+		bool in_fragment = false;
+		bool have_styp = false;
+		std::vector<uint64_t> init_boxes;
+
+		// one allocation for all entries instead of growing the vector while walking
+		fragments_.reserve(count_fragments(d, size));
+
+		while (pos + 8 <= size)
+		{
+			const uint64_t box_size = read_box_size(d + pos, size - pos);
+			if (!box_size)
+			{
+				// continue at the next fragment, the damaged one is dropped
+				const uint64_t next = pos + 1 + box_scan::find_fragment_box(d + pos + 1, size - pos - 1);
+				if (next >= size)
+				{
+					std::cout << "invalid box size at offset " << pos << ", ignoring the remaining bytes" << std::endl;
+					break;
+				}
+
+				std::cout << "invalid box size at offset " << pos << ", skipping " << next - pos << " bytes to the next fragment" << std::endl;
+				in_fragment = false;
+				pos = next;
+				continue;
+			}
+
+			const uint32_t type = fourcc::get_type(d + pos);
+
+			if (type == fourcc::ftyp)
+			{
+				data_.insert(data_.end(), d + pos, d + pos + box_size);
+				init_boxes.push_back(pos);
+				init_boxes.push_back(box_size);
+			}
+			else if (type == fourcc::moov)
+			{
+				const uint64_t header = read_header_size(d + pos);
+				timescale_ = parse_timescale(d + pos + header, box_size - header);
+				parse_trex(d + pos + header, box_size - header, default_duration, default_flags);
+				data_.insert(data_.end(), d + pos, d + pos + box_size);
+				init_size_ = data_.size();
+				init_boxes.push_back(pos);
+				init_boxes.push_back(box_size);
+			}
+			else if (type == fourcc::styp || type == fourcc::prft ||
+				type == fourcc::emsg || type == fourcc::moof)
+			{
+				if (!in_fragment)
+				{
+					f = fragment_entry_t();
+					f.offset_ = pos;
+					in_fragment = true;
+				}
+
+				if (type == fourcc::styp)
+				{
+					f.segment_start_ = 1;
+					have_styp = true;
+				}
+
+				if (type == fourcc::moof)
+					parse_moof(d + pos, box_size, pos, default_duration, default_flags, f);
+			}
+			else if (type == fourcc::mdat && in_fragment)
+			{
+				f.size_ = pos + box_size - f.offset_;
+				fragments_.push_back(f);
+				in_fragment = false;
+			}
+			pos += box_size;
+		}
+
+		// without styp boxes a segment starts at each sync chunk, the first chunk always starts one
+		for (size_t i = 0; i < fragments_.size(); i++)
+			fragments_[i].segment_start_ = i == 0 || (have_styp ? fragments_[i].segment_start_ : fragments_[i].sync_);
+
+		// a read only directory only costs the walk on the next run
+		if (use_index && init_size_ > 0)
+			write_index(index_name, init_boxes);
+
+		return init_size_ > 0;
+	}
+
+	// fragment index file: magic, version, size and modification time of the
+	// track file, timescale, the ftyp and moov boxes and then an entry per
+	// fragment, all big endian like the boxes
+	static const char index_magic[8] = { 'f', 'm', 'p', '4', 'f', 'i', 'd', 'x' };
+	static const uint32_t index_version = 4;
+	static const size_t index_header_size = 8 + 4 + 8 + 8 + 4 + 4;
+	static const size_t index_entry_size = 8 * 6 + 4 + 1 + 1 + 1 + 1;
+
+	std::string get_index_name(const std::string &file_name)
+	{
+		return file_name + ".fidx";
+	}
+
+	// the nanoseconds tell a track rewritten within the same second as its index
+	bool get_file_stamp(const std::string &file_name, uint64_t &size, uint64_t &mtime)
+	{
+		struct stat st;
+		if (stat(file_name.c_str(), &st) != 0)
+			return false;
+
+		size = (uint64_t)st.st_size;
+#if defined(_WIN32)
+		mtime = (uint64_t)st.st_mtime * 1000000000ULL; // stat has whole seconds here
+#elif defined(__APPLE__)
+		mtime = (uint64_t)st.st_mtimespec.tv_sec * 1000000000ULL + (uint64_t)st.st_mtimespec.tv_nsec;
+#else
+		mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+#endif
+		return true;
+	}
+
+	bool track_store_t::load_index(const std::string &index_name)
+	{
+		data_.clear();
+		fragments_.clear();
+		init_size_ = 0;
+
+		uint64_t file_size = 0;
+		uint64_t mtime = 0;
+		if (!get_file_stamp(map_.file_name_, file_size, mtime) || file_size != map_.size())
+			return false;
+
+		std::ifstream in(index_name, std::ios::binary);
+		if (!in.good())
+			return false;
+
+		std::vector<uint8_t> idx((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		if (idx.size() < index_header_size || memcmp(&idx[0], index_magic, 8) != 0 ||
+			read_32(&idx[8]) != index_version || read_64(&idx[12]) != file_size || read_64(&idx[20]) != mtime)
+			return false;
+
+		const uint8_t *d = map_.data();
+		const uint32_t init_count = read_32(&idx[32]);
+		uint64_t pos = index_header_size;
+
+		if (idx.size() < pos + (uint64_t)init_count * 16 + 8)
+			return false;
+
+		for (uint32_t i = 0; i < init_count; i++, pos += 16)
+		{
+			const uint64_t offset = read_64(&idx[pos]);
+			const uint64_t size = read_64(&idx[pos + 8]);
+			if (offset > file_size || size > file_size - offset)
+			{
+				data_.clear();
+				return false;
+			}
+			data_.insert(data_.end(), d + offset, d + offset + size);
+		}
+
+		const uint64_t count = read_64(&idx[pos]);
+		pos += 8;
+		if ((idx.size() - pos) / index_entry_size < count)
+		{
+			data_.clear();
+			return false;
+		}
+
+		fragments_.resize((size_t)count);
+		for (size_t i = 0; i < fragments_.size(); i++, pos += index_entry_size)
+		{
+			fragment_entry_t &f = fragments_[i];
+			const uint8_t *p = &idx[pos];
+
+			f.offset_ = read_64(p);
+			f.size_ = read_64(p + 8);
+			f.base_media_decode_time_ = read_64(p + 16);
+			f.duration_ = read_64(p + 24);
+			f.tfdt_offset_ = read_64(p + 32);
+			f.mfhd_offset_ = read_64(p + 40);
+			f.sequence_number_ = read_32(p + 48);
+			f.tfdt_version_ = p[52];
+			f.sync_ = p[53];
+			f.segment_start_ = p[54];
+
+			// the senders trust these offsets, so a damaged index is not used
+			if (f.offset_ > file_size || f.size_ > file_size - f.offset_ ||
+				(f.tfdt_offset_ && (f.tfdt_offset_ < f.offset_ || f.tfdt_offset_ + (f.tfdt_version_ == 1 ? 20 : 16) > f.offset_ + f.size_)) ||
+				(f.mfhd_offset_ && (f.mfhd_offset_ < f.offset_ || f.mfhd_offset_ + 16 > f.offset_ + f.size_)))
+			{
+				data_.clear();
+				fragments_.clear();
+				return false;
+			}
+		}
+
+		timescale_ = read_32(&idx[28]);
+		init_size_ = data_.size();
+		return init_size_ > 0;
+	}
+
+	bool track_store_t::write_index(const std::string &index_name, const std::vector<uint64_t> &init_boxes) const
+	{
+		uint64_t file_size = 0;
+		uint64_t mtime = 0;
+		if (!get_file_stamp(map_.file_name_, file_size, mtime) || file_size != map_.size())
+			return false;
+
+		std::vector<uint8_t> idx(index_header_size + init_boxes.size() * 8 + 8 + fragments_.size() * index_entry_size);
+		memcpy(&idx[0], index_magic, 8);
+		write_32(&idx[8], index_version);
+		write_64(&idx[12], file_size);
+		write_64(&idx[20], mtime);
+		write_32(&idx[28], timescale_);
+		write_32(&idx[32], (uint32_t)(init_boxes.size() / 2));
+
+		uint64_t pos = index_header_size;
+		for (size_t i = 0; i < init_boxes.size(); i++, pos += 8)
+			write_64(&idx[pos], init_boxes[i]);
+
+		write_64(&idx[pos], fragments_.size());
+		pos += 8;
+		for (size_t i = 0; i < fragments_.size(); i++, pos += index_entry_size)
+		{
+			const fragment_entry_t &f = fragments_[i];
+			uint8_t *p = &idx[pos];
+
+			write_64(p, f.offset_);
+			write_64(p + 8, f.size_);
+			write_64(p + 16, f.base_media_decode_time_);
+			write_64(p + 24, f.duration_);
+			write_64(p + 32, f.tfdt_offset_);
+			write_64(p + 40, f.mfhd_offset_);
+			write_32(p + 48, f.sequence_number_);
+			p[52] = f.tfdt_version_;
+			p[53] = f.sync_;
+			p[54] = f.segment_start_;
+		}
+
+		// written to a temporary file and renamed, so a concurrent run never reads a partial
+		// index. the name is unique per process and thread, the same track can be loaded by
+		// other runs or twice in one run at the same time
+		const std::string tmp_name = index_name + "." + std::to_string((long long)getpid()) + "." +
+			std::to_string((unsigned long long)std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+		std::ofstream out(tmp_name, std::ios::binary);
+		if (!out.good())
+			return false;
+
+		out.write((const char *)&idx[0], idx.size());
+		out.close();
+		if (!out.good())
+		{
+			std::remove(tmp_name.c_str());
+			return false;
+		}
+		return std::rename(tmp_name.c_str(), index_name.c_str()) == 0;
+	}
+
+	segment_view_t track_store_t::get_init_segment() const
+	{
+		segment_view_t v = { data_.data(), (size_t)init_size_ };
+		return v;
+	}
+
+	segment_view_t track_store_t::get_media_segment(size_t index) const
+	{
+		segment_view_t v = { data() + fragments_[index].offset_, (size_t)fragments_[index].size_ };
+		return v;
+	}
+
+	// write the decode time in a tfdt box, returns false if it does not fit a version 0 box
+	static bool write_tfdt(uint8_t *tfdt, uint8_t version, uint64_t base_media_decode_time)
+	{
+		uint8_t *p = tfdt + 12;
+		if (version == 1)
+		{
+			write_32(p, (uint32_t)(base_media_decode_time >> 32));
+			write_32(p + 4, (uint32_t)base_media_decode_time);
+			return true;
+		}
+
+		write_32(p, (uint32_t)base_media_decode_time);
+		return (base_media_decode_time >> 32) == 0;
+	}
+
+	segment_view_t track_store_t::get_media_segment(size_t index, uint64_t offset, uint32_t sequence_offset, std::vector<uint8_t> &buf) const
+	{
+		const fragment_entry_t &f = fragments_[index];
+		segment_view_t v = get_media_segment(index);
+
+		// only the boxes at the recorded offsets change, the fragment is not walked again
+		const bool patch_tfdt = offset && f.tfdt_offset_;
+		const bool patch_mfhd = sequence_offset && f.mfhd_offset_;
+		if (!patch_tfdt && !patch_mfhd)
+			return v;
+
+		buf.assign(v.data_, v.data_ + v.size_);
+		if (patch_tfdt && !write_tfdt(&buf[f.tfdt_offset_ - f.offset_], f.tfdt_version_, f.base_media_decode_time_ + offset) && !index)
+			std::cout << "tfdt version 0 overflow, decode time truncated to 32 bits" << std::endl;
+		if (patch_mfhd)
+			write_32(&buf[f.mfhd_offset_ - f.offset_ + 12], f.sequence_number_ + sequence_offset);
+
+		v.data_ = buf.data();
+		return v;
+	}
+
+	bool track_store_t::get_samples(size_t index, std::vector<sample_entry_t> &samples) const
+	{
+		samples.clear();
+		if (index >= fragments_.size())
+			return false;
+
+		// the sample defaults of the trex box
+		uint32_t default_duration = 0;
+		uint32_t default_size = 0;
+		uint32_t default_flags = 0;
+		const uint64_t moov = find_box(data_.data(), init_size_, fourcc::moov);
+		if (moov != init_size_)
+		{
+			const uint64_t header = read_header_size(&data_[moov]);
+			parse_trex(&data_[moov + header], read_box_size(&data_[moov], init_size_ - moov) - header, default_duration, default_flags, &default_size);
+		}
+
+		const fragment_entry_t &f = fragments_[index];
+		const uint8_t *d = data() + f.offset_;
+		const uint64_t moof = find_box(d, f.size_, fourcc::moof);
+		if (moof == f.size_)
+			return false;
+
+		uint64_t traf_size = 0;
+		const uint64_t header = read_header_size(d + moof);
+		const uint8_t *traf = find_payload(d + moof + header, read_box_size(d + moof, f.size_ - moof) - header, { fourcc::traf }, traf_size);
+		if (!traf)
+			return false;
+
+		fragment_entry_t timing = f;
+		// every sample takes at least a byte of the fragment
+		parse_traf(traf, traf_size, default_duration, default_flags, timing, &samples, default_size, f.size_);
+
+		uint64_t t = f.base_media_decode_time_;
+		for (auto &e : samples)
+		{
+			e.decode_time_ = t;
+			t += e.duration_;
+		}
+		return true;
+	}
+
+	uint64_t track_store_t::get_start_time() const
+	{
+		return fragments_.size() ? fragments_[0].base_media_decode_time_ : 0;
+	}
+
+	uint64_t track_store_t::get_duration() const
+	{
+		if (!fragments_.size())
+			return 0;
+
+		const fragment_entry_t &last = fragments_.back();
+		return last.base_media_decode_time_ + last.duration_ - fragments_[0].base_media_decode_time_;
+	}
+
+	size_t track_store_t::get_segment_end(size_t index) const
+	{
+		size_t end = index + 1;
+		while (end < fragments_.size() && !fragments_[end].segment_start_)
+			end++;
+		return end;
+	}
+
+	track_reader_t::track_reader_t()
+		: file_(NULL)
+		, follow_(false)
+		, idle_timeout_ms_(0)
+		, buf_offset_(0)
+		, timescale_(0)
+		, default_duration_(0)
+		, default_flags_(0)
+		, time_offset_(0)
+		, max_segment_size_(256 << 20)
+	{
+	}
+
+	track_reader_t::~track_reader_t()
+	{
+		close();
+	}
+
+	bool track_reader_t::open(const std::string &file_name, bool follow, unsigned int idle_timeout_ms)
+	{
+		close();
+		if (file_name == "-")
+		{
+			file_ = stdin;
+#ifdef _WIN32
+			_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		}
+		else
+		{
+			file_ = fopen(file_name.c_str(), "rb");
+		}
+
+		follow_ = follow;
+		idle_timeout_ms_ = idle_timeout_ms;
+		buf_.clear();
+		buf_offset_ = 0;
+		timescale_ = 0;
+		default_duration_ = 0;
+		default_flags_ = 0;
+		return file_ != NULL;
+	}
+
+	void track_reader_t::close()
+	{
+		if (file_ && file_ != stdin)
+			fclose(file_);
+		file_ = NULL;
+	}
+
+	bool track_reader_t::is_pipe(const std::string &file_name)
+	{
+		if (file_name == "-")
+			return true;
+#ifndef _WIN32
+		struct stat st;
+		if (stat(file_name.c_str(), &st) == 0)
+			return S_ISFIFO(st.st_mode);
+#endif
+		return false;
+	}
+
+	bool track_reader_t::read_more()
+	{
+		uint8_t tmp[65536];
+		std::chrono::steady_clock::time_point idle_start = std::chrono::steady_clock::now();
+
+		while (file_)
+		{
+			// read what is available instead of waiting for a full buffer like fread
+#ifdef _WIN32
+			const int n = _read(_fileno(file_), tmp, sizeof(tmp));
+#else
+			const ssize_t n = ::read(fileno(file_), tmp, sizeof(tmp));
+#endif
+			if (n > 0)
+			{
+				buf_.insert(buf_.end(), tmp, tmp + n);
+				return true;
+			}
+
+			// a pipe ends when the writer closes it, a followed file when it stops growing
+			if (n < 0 || !follow_ || std::chrono::steady_clock::now() - idle_start >= std::chrono::milliseconds(idle_timeout_ms_))
+				return false;
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		return false;
+	}
+
+	void track_reader_t::consume(size_t n)
+	{
+		buf_.erase(buf_.begin(), buf_.begin() + n);
+		buf_offset_ += n;
+	}
+
+	bool track_reader_t::resync(size_t pos)
+	{
+		// the segment up to the damaged box and its header are dropped
+		consume(pos + 1);
+
+		for (;;)
+		{
+			const uint64_t next = buf_.empty() ? 0 : box_scan::find_fragment_box(&buf_[0], buf_.size());
+			if (next < buf_.size())
+			{
+				consume((size_t)next);
+				return true;
+			}
+
+			// a fragment box is only found when its size fits the buffered bytes, keep
+			// the tail so a box that started in it is found once more bytes are read
+			if (buf_.size() > resync_window)
+				consume(buf_.size() - resync_window / 2);
+
+			if (!read_more())
+				return false;
+		}
+	}
+
+	segment_type_t track_reader_t::read_segment(std::vector<uint8_t> &seg, fragment_entry_t &f)
+	{
+		uint64_t pos = 0; // end of the boxes of the current segment in buf_
+		uint64_t start = 0; // start of the fragment in buf_
+		bool in_fragment = false;
+
+		f = fragment_entry_t();
+
+		for (;;)
+		{
+			while (buf_.size() < pos + 8 || (read_32(&buf_[pos]) == 1 && buf_.size() < pos + 16))
+			{
+				if (!read_more())
+					return end_of_input;
+			}
+
+			const uint32_t size_field = read_32(&buf_[pos]);
+			uint64_t box_size = size_field;
+			if (size_field == 1)
+				box_size = ((uint64_t)read_32(&buf_[pos + 8]) << 32) | read_32(&buf_[pos + 12]);
+
+			// an mdat that extends to the end of the input ends the last fragment, it
+			// is buffered up to the segment limit like any other box
+			if (size_field == 0 && in_fragment && fourcc::get_type(&buf_[pos]) == fourcc::mdat)
+			{
+				while (read_more())
+				{
+					if (buf_.size() > max_segment_size_)
+						break;
+				}
+				box_size = buf_.size() - pos;
+			}
+
+			// a damaged size field would make the reader buffer without limit, the
+			// segment it is in is dropped and the reader continues at the next fragment
+			if (box_size < (size_field == 1 ? 16u : 8u) || box_size > max_segment_size_ - pos)
+			{
+				// stderr, the output of the reader can be a stream of records on stdout
+				fprintf(stderr, "invalid box size at offset %llu, skipping to the next fragment\n", (unsigned long long)(buf_offset_ + pos));
+				if (!resync((size_t)pos))
+					return end_of_input;
+
+				pos = 0;
+				start = 0;
+				in_fragment = false;
+				f = fragment_entry_t();
+				continue;
+			}
+
+			while (buf_.size() < pos + box_size)
+			{
+				if (!read_more())
+					return end_of_input;
+			}
+
+			const uint8_t *d = &buf_[pos];
+			const uint32_t type = fourcc::get_type(d);
+
+			if (type == fourcc::ftyp && !in_fragment)
+			{
+				if (!pos)
+					f.offset_ = buf_offset_;
+				pos += box_size;
+			}
+			else if (type == fourcc::moov && !in_fragment)
+			{
+				if (!pos)
+					f.offset_ = buf_offset_;
+				const uint64_t header = read_header_size(d);
+				timescale_ = parse_timescale(d + header, box_size - header);
+				parse_trex(d + header, box_size - header, default_duration_, default_flags_);
+				pos += box_size;
+				f.size_ = pos;
+				seg.assign(buf_.begin(), buf_.begin() + pos);
+				consume((size_t)pos);
+				return init_segment;
+			}
+			else if (type == fourcc::styp || type == fourcc::prft ||
+				type == fourcc::emsg || type == fourcc::moof)
+			{
+				if (!in_fragment)
+				{
+					start = pos;
+					in_fragment = true;
+					f.offset_ = buf_offset_ + start;
+				}
+
+				if (type == fourcc::moof)
+					parse_moof(d, box_size, buf_offset_ + pos, default_duration_, default_flags_, f);
+				pos += box_size;
+			}
+			else if (type == fourcc::mdat && in_fragment)
+			{
+				pos += box_size;
+				f.size_ = pos - start;
+				seg.assign(buf_.begin() + start, buf_.begin() + pos);
+				consume((size_t)pos);
+
+				if (f.tfdt_offset_ && time_offset_)
+				{
+					f.base_media_decode_time_ += time_offset_;
+					if (!write_tfdt(&seg[f.tfdt_offset_ - f.offset_], f.tfdt_version_, f.base_media_decode_time_))
+						fprintf(stderr, "tfdt version 0 overflow, decode time truncated to 32 bits\n");
+				}
+				return media_segment;
+			}
+			else if (in_fragment)
+			{
+				pos += box_size; // part of the fragment
+			}
+			else
+			{
+				// not part of a segment, drop the box
+				buf_.erase(buf_.begin() + pos, buf_.begin() + pos + box_size);
+				buf_offset_ += box_size;
+			}
+		}
+	}
+
+	track_validator_t::track_validator_t()
+		: finding_count_(0), fragments_(0), have_init_(false), have_time_(false), next_decode_time_(0),
+		sequence_number_(0), default_duration_(0), default_size_(0), default_flags_(0)
+	{
+	}
+
+	void track_validator_t::add(uint64_t offset, const char *check, const std::string &message)
+	{
+		finding_t r = { offset, check, message };
+		findings_.push_back(r);
+		finding_count_++;
+	}
+
+	void track_validator_t::check_init_segment(const uint8_t *data, uint64_t size, uint64_t offset)
+	{
+		have_init_ = true;
+		if (find_box(data, size, fourcc::ftyp) == size)
+			add(offset, "ftyp_missing", "init segment without ftyp box");
+
+		const uint64_t moov = find_box(data, size, fourcc::moov);
+		if (moov == size)
+		{
+			add(offset, "moov_missing", "init segment without moov box");
+			return;
+		}
+
+		const uint64_t header = read_header_size(data + moov);
+		const uint8_t *payload = data + moov + header;
+		const uint64_t moov_size = read_box_size(data + moov, size - moov) - header;
+		uint64_t payload_size = 0;
+		if (!parse_timescale(payload, moov_size))
+			add(offset + moov, "timescale_missing", "moov without a track timescale");
+		if (!find_payload(payload, moov_size, { fourcc::mvex, fourcc::trex }, payload_size))
+			add(offset + moov, "trex_missing", "moov without mvex and trex, the track is not fragmented");
+
+		parse_trex(payload, moov_size, default_duration_, default_flags_, &default_size_);
+	}
+
+	void track_validator_t::check_media_segment(const uint8_t *data, const fragment_entry_t &f)
+	{
+		if (!fragments_++ && !have_init_)
+			add(f.offset_, "init_missing", "fragment before the init segment");
+
+		const uint64_t moof = find_box(data, f.size_, fourcc::moof);
+		if (moof == f.size_)
+		{
+			add(f.offset_, "moof_missing", "fragment without moof box");
+			return;
+		}
+
+		if (fragments_ > 1 && f.sequence_number_ <= sequence_number_)
+			add(f.offset_ + moof, "sequence_number", "mfhd sequence number " + std::to_string(f.sequence_number_) +
+				" does not increase, the previous is " + std::to_string(sequence_number_));
+		sequence_number_ = f.sequence_number_;
+
+		// cmaf has one traf per moof, each with a tfdt
+		const uint64_t moof_size = read_box_size(data + moof, f.size_ - moof);
+		uint64_t sample_bytes = 0;
+		uint64_t pos = read_header_size(data + moof);
+		int traf_count = 0;
+		while (pos + 8 <= moof_size)
+		{
+			const uint64_t box_size = read_box_size(data + moof + pos, moof_size - pos);
+			if (!box_size)
+				break;
+
+			if (fourcc::get_type(data + moof + pos) == fourcc::traf)
+			{
+				const uint64_t header = read_header_size(data + moof + pos);
+				const uint8_t *traf = data + moof + pos + header;
+				traf_count++;
+				if (find_box(traf, box_size - header, fourcc::tfdt) == box_size - header)
+					add(f.offset_ + moof + pos, "tfdt_missing", "traf without tfdt box");
+
+				fragment_entry_t timing = f;
+				samples_.clear();
+				parse_traf(traf, box_size - header, default_duration_, default_flags_, timing, &samples_, default_size_, f.size_);
+				for (const auto &e : samples_)
+					sample_bytes += e.size_;
+			}
+			pos += box_size;
+		}
+
+		if (traf_count != 1)
+			add(f.offset_ + moof, "traf_count", "moof with " + std::to_string(traf_count) + " traf boxes, cmaf has one");
+
+		// the samples are the payload of the mdat
+		const uint64_t mdat = find_box(data, f.size_, fourcc::mdat);
+		if (mdat != f.size_)
+		{
+			const uint64_t mdat_size = read_box_size(data + mdat, f.size_ - mdat);
+			const uint64_t header_size = read_32(data + mdat) == 1 ? 16 : 8;
+			const uint64_t mdat_payload = mdat_size > header_size ? mdat_size - header_size : 0;
+			if (sample_bytes != mdat_payload)
+				add(f.offset_ + mdat, "trun_mdat_size", "trun sample sizes add up to " + std::to_string(sample_bytes) +
+					" bytes, the mdat has " + std::to_string(mdat_payload));
+		}
+
+		// the decode time continues where the previous fragment ended
+		if (f.tfdt_offset_)
+		{
+			if (have_time_ && f.base_media_decode_time_ < next_decode_time_)
+				add(f.tfdt_offset_, "tfdt_monotonic", "decode time " + std::to_string(f.base_media_decode_time_) +
+					" is before the end of the previous fragment " + std::to_string(next_decode_time_));
+			else if (have_time_ && f.base_media_decode_time_ > next_decode_time_)
+				add(f.tfdt_offset_, "tfdt_contiguous", "decode time " + std::to_string(f.base_media_decode_time_) +
+					" leaves a gap after the end of the previous fragment " + std::to_string(next_decode_time_));
+
+			next_decode_time_ = f.base_media_decode_time_ + f.duration_;
+			have_time_ = true;
+		}
+	}
+
+	void track_validator_t::check_end(uint64_t offset, uint64_t trailing_bytes)
+	{
+		if (trailing_bytes)
+			add(offset, "truncated", std::to_string(trailing_bytes) + " bytes at the end are not a complete init segment or fragment");
+		if (!fragments_)
+			add(offset, "no_fragments", "the input has no fragments");
+	}
+}
@@ -0,0 +1,207 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+serialized init and media segments of a track, the sender posts views on
+these bytes instead of serializing a fragment for every post
+
+******************************************************************************/
+
+#ifndef INGEST_TRACK_H
+#define INGEST_TRACK_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "mapped_file.h"
+
+namespace ingest_track
+{
+	// read only view on segment bytes
+	struct segment_view_t
+	{
+		const uint8_t *data_;
+		size_t size_;
+	};
+
+	// position and timing of a media fragment in the track bytes
+	struct fragment_entry_t
+	{
+		uint64_t offset_; // offset of the fragment (styp, emsg, moof, mdat) in the track bytes
+		uint64_t size_; // size of the fragment in bytes
+		uint64_t base_media_decode_time_; // tfdt of the fragment
+		uint64_t duration_; // duration of the fragment in timescale units
+		uint64_t tfdt_offset_; // offset of the tfdt box in the track bytes, 0 if not found
+		uint8_t tfdt_version_; // version of the tfdt box, version 0 has a 32 bit decode time
+		uint8_t sync_; // the first sample is a sync sample
+		uint32_t sequence_number_; // sequence number of the mfhd box
+		uint64_t mfhd_offset_; // offset of the mfhd box in the track bytes, 0 if not found
+		uint8_t segment_start_; // the fragment is the first cmaf chunk of a segment
+	};
+
+	// sample of a media fragment from its trun, with the tfhd and trex defaults
+	struct sample_entry_t
+	{
+		uint64_t decode_time_;
+		uint32_t duration_;
+		uint32_t size_;
+		uint32_t flags_;
+		uint32_t composition_time_offset_; // signed in a version 1 trun
+	};
+
+	// offset of the tfdt box in a fragment (moof/traf/tfdt), 0 if not found
+	uint64_t find_tfdt_offset(const uint8_t *data, uint64_t size);
+
+	// name of the fragment index written next to a track file
+	std::string get_index_name(const std::string &file_name);
+
+	// size and modification time in nanoseconds of a track file, its index is used
+	// only when both match the stamp in the index header
+	bool get_file_stamp(const std::string &file_name, uint64_t &size, uint64_t &mtime);
+
+	// init segment followed by all media fragments of a track in one buffer. each
+	// fragment (moof and mdat) is a cmaf chunk, a segment is a run of chunks that
+	// starts at a chunk with a styp box or, in a track without styp boxes, at a
+	// chunk that starts with a sync sample
+	struct track_store_t
+	{
+		track_store_t() : init_size_(0), timescale_(0) {}
+
+		// map a cmaf file and index it by walking the box headers in place,
+		// only the ftyp and moov are copied, the fragments are views on the mapping.
+		// only with use_index the fragment index of an earlier run is used when the
+		// file did not change since, otherwise it is written after the walk
+		bool load_from_file(const std::string &file_name, bool use_index = false);
+
+		// read the fragment index, false if it is missing, invalid or out of date
+		bool load_index(const std::string &index_name);
+
+		// write the fragment index, init_boxes has the offset and size of the ftyp and moov
+		bool write_index(const std::string &index_name, const std::vector<uint64_t> &init_boxes) const;
+
+		// bytes the fragment offsets refer to
+		const uint8_t *data() const { return map_.data() ? map_.data() : data_.data(); }
+
+		segment_view_t get_init_segment() const;
+		segment_view_t get_media_segment(size_t index) const;
+
+		// media fragment with offset added to its decode time and sequence_offset to
+		// its sequence number, the track bytes are shared by the senders and not
+		// modified, the tfdt and mfhd are patched in a copy in buf
+		segment_view_t get_media_segment(size_t index, uint64_t offset, uint32_t sequence_offset, std::vector<uint8_t> &buf) const;
+
+		uint64_t get_start_time() const;
+		uint64_t get_duration() const;
+
+		// one past the last chunk of the segment that fragment index is in
+		size_t get_segment_end(size_t index) const;
+
+		// decode the sample table of a fragment, loading only decodes the timing
+		// of the fragments so the samples are decoded when something needs them
+		bool get_samples(size_t index, std::vector<sample_entry_t> &samples) const;
+
+		std::vector<uint8_t> data_; // init segment, followed by the fragments when not mapped
+		mapped_file_t map_;
+		uint64_t init_size_;
+		std::vector<fragment_entry_t> fragments_;
+		uint32_t timescale_;
+	};
+
+	// segment returned by the track reader
+	enum segment_type_t
+	{
+		end_of_input,
+		init_segment,
+		media_segment
+	};
+
+	// incremental reader of a cmaf track from stdin, a pipe or a file that is still
+	// being written, the init segment and each fragment are returned as soon as all
+	// their bytes arrived instead of after the whole input was read
+	struct track_reader_t
+	{
+		track_reader_t();
+		~track_reader_t();
+
+		// open a file, - is stdin. with follow the end of a regular file is not the
+		// end of the input until it did not grow for idle_timeout_ms
+		bool open(const std::string &file_name, bool follow, unsigned int idle_timeout_ms);
+		void close();
+
+		// true for stdin and fifos, these can only be read incrementally
+		static bool is_pipe(const std::string &file_name);
+
+		// read the next init segment or fragment into seg, f has its position in the
+		// input and its timing, the decode time includes time_offset_. boxes between
+		// the ftyp and moov are dropped, the offset of an init segment is its ftyp
+		segment_type_t read_segment(std::vector<uint8_t> &seg, fragment_entry_t &f);
+
+		// read more bytes of the input into buf_, false at the end of the input
+		bool read_more();
+
+		// remove n bytes from the front of buf_
+		void consume(size_t n);
+
+		// drop buf_ up to and including the first byte of the damaged box at pos and
+		// continue at the next fragment box, false at the end of the input
+		bool resync(size_t pos);
+
+		// bytes buffered while looking for the next fragment box after a damaged one
+		static const size_t resync_window = 1 << 20;
+
+		FILE *file_;
+		bool follow_;
+		unsigned int idle_timeout_ms_;
+		std::vector<uint8_t> buf_; // bytes read but not returned yet
+		uint64_t buf_offset_; // offset of buf_ in the input
+		uint32_t timescale_;
+		uint32_t default_duration_; // sample duration of the trex box
+		uint32_t default_flags_; // sample flags of the trex box
+		uint64_t time_offset_; // added to the decode time of every fragment
+		uint64_t max_segment_size_; // a segment or box larger than this is treated as damaged
+	};
+
+	// a cmaf or dash-if ingest constraint a track does not meet
+	struct finding_t
+	{
+		uint64_t offset_; // offset in the input of the box the finding is about
+		std::string check_; // name of the check, like tfdt_contiguous
+		std::string message_;
+	};
+
+	// checks a track one segment at a time in input order, so it is validated
+	// in the same single pass that reads it
+	struct track_validator_t
+	{
+		track_validator_t();
+
+		// init segment at offset in the input
+		void check_init_segment(const uint8_t *data, uint64_t size, uint64_t offset);
+
+		// fragment with its position and timing from the track reader
+		void check_media_segment(const uint8_t *data, const fragment_entry_t &f);
+
+		// end of the input at offset, trailing_bytes did not make a complete segment
+		void check_end(uint64_t offset, uint64_t trailing_bytes);
+
+		void add(uint64_t offset, const char *check, const std::string &message);
+
+		std::vector<finding_t> findings_; // the caller reports and clears these
+		uint64_t finding_count_;
+		uint64_t fragments_;
+		bool have_init_;
+		bool have_time_;
+		uint64_t next_decode_time_; // end of the previous fragment
+		uint32_t sequence_number_; // of the previous fragment
+		uint32_t default_duration_;
+		uint32_t default_size_;
+		uint32_t default_flags_;
+		std::vector<sample_entry_t> samples_;
+	};
+}
+
+#endif
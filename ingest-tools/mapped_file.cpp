@@ -0,0 +1,127 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+******************************************************************************/
+
+#include "mapped_file.h"
+#include <fstream>
+#include <iterator>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mapped_file_t::mapped_file_t()
+	: data_(NULL)
+	, size_(0)
+{
+}
+
+mapped_file_t::mapped_file_t(const mapped_file_t &other)
+	: data_(NULL)
+	, size_(0)
+{
+	if (other.data_)
+		open(other.file_name_);
+}
+
+mapped_file_t &mapped_file_t::operator=(const mapped_file_t &other)
+{
+	if (this != &other)
+	{
+		close();
+		if (other.data_)
+			open(other.file_name_);
+	}
+	return *this;
+}
+
+mapped_file_t::~mapped_file_t()
+{
+	close();
+}
+
+bool mapped_file_t::open(const std::string &file_name)
+{
+	close();
+	file_name_ = file_name;
+
+#ifdef _WIN32
+	std::ifstream input(file_name, std::ifstream::binary);
+	if (!input.good())
+		return false;
+
+	buf_.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+	data_ = buf_.size() ? &buf_[0] : NULL;
+	size_ = buf_.size();
+	return data_ != NULL;
+#else
+	int fd = ::open(file_name.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (p == MAP_FAILED)
+		return false;
+
+	data_ = (uint8_t *)p;
+	size_ = (size_t)st.st_size;
+	return true;
+#endif
+}
+
+void mapped_file_t::close()
+{
+#ifdef _WIN32
+	buf_.clear();
+#else
+	if (data_)
+		munmap((void *)data_, size_);
+#endif
+	data_ = NULL;
+	size_ = 0;
+}
+
+mapped_streambuf::mapped_streambuf(const mapped_file_t &file)
+{
+	char *p = (char *)file.data();
+	setg(p, p, p + file.size());
+}
+
+mapped_streambuf::pos_type mapped_streambuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+	char *p = gptr();
+	if (dir == std::ios_base::beg)
+		p = eback() + off;
+	else if (dir == std::ios_base::cur)
+		p = gptr() + off;
+	else
+		p = egptr() + off;
+
+	if (!(which & std::ios_base::in) || p < eback() || p > egptr())
+		return pos_type(off_type(-1));
+
+	setg(eback(), p, egptr());
+	return pos_type(off_type(p - eback()));
+}
+
+mapped_streambuf::pos_type mapped_streambuf::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+	return seekoff(off_type(pos), std::ios_base::beg, which);
+}
@@ -0,0 +1,55 @@
+/*******************************************************************************
+Supplementary software media ingest specification:
+https://github.com/unifiedstreaming/fmp4-ingest
+
+Copyright (C) 2009-2021 CodeShop B.V.
+http://www.code-shop.com
+
+memory mapped input files, the bytes stay in the page cache that is shared
+by all processes reading the same file
+
+******************************************************************************/
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <streambuf>
+#include <vector>
+
+// read only mapping of a file, the senders patch copies of the fragments so a
+// stray write faults instead of silently copying the page
+struct mapped_file_t
+{
+	mapped_file_t();
+	mapped_file_t(const mapped_file_t &other); // maps the same file again
+	mapped_file_t &operator=(const mapped_file_t &other);
+	~mapped_file_t();
+
+	bool open(const std::string &file_name);
+	void close();
+
+	const uint8_t *data() const { return data_; }
+	size_t size() const { return size_; }
+
+	std::string file_name_;
+	const uint8_t *data_;
+	size_t size_;
+#ifdef _WIN32
+	std::vector<uint8_t> buf_; // no mmap, the file is read into memory
+#endif
+};
+
+// read only stream buffer on a mapped file, lets the istream based parsers
+// read directly from the mapping instead of through a file stream
+struct mapped_streambuf : public std::streambuf
+{
+	explicit mapped_streambuf(const mapped_file_t &file);
+
+protected:
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which);
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+};
+
+#endif
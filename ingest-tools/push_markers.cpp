@@ -11,6 +11,7 @@
 #include "event/base64.h"
 
 #include "event/event_track.h"
+#include "curl_share.h"
 #include <fstream>
 
 /*
@@ -97,29 +98,37 @@ struct push_marker_options_t
 };
 
 // use curl to push the segment/hedaer using HTTP post over HTTP 1.1.
+// the handle is kept so the connection and tls session are reused for each segment
 struct PostCurlIngestConnection 
 {
+    PostCurlIngestConnection()
+        : curl_(curl_easy_init())
+    {
+        curl_share_t::get().attach(curl_);
+        curl_easy_setopt(curl_, CURLOPT_SSL_VERIFYPEER, 0);
+        curl_easy_setopt(curl_, CURLOPT_SSL_VERIFYHOST, 0);
+        curl_easy_setopt(curl_, CURLOPT_POST, 1);
+        curl_easy_setopt(curl_, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    }
+
+    ~PostCurlIngestConnection()
+    {
+        curl_easy_cleanup(curl_);
+    }
 
-    static CURLcode send_curl_post(std::string &post_url, std::vector<uint8_t> &data) {
+    CURLcode send_curl_post(std::string &post_url, std::vector<uint8_t> &data) {
        
             try {
-                CURL* curl = curl_easy_init();
-                curl_easy_setopt(curl, CURLOPT_URL, post_url.c_str());
-                curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
-                curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
-                curl_easy_setopt(curl, CURLOPT_POST, 1);
-                curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
-
-                curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (char*)&data[0]);
-                curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)data.size());
-                CURLcode res = curl_easy_perform(curl);
-                curl_easy_cleanup(curl);
+                curl_easy_setopt(curl_, CURLOPT_URL, post_url.c_str());
+
+                curl_easy_setopt(curl_, CURLOPT_POSTFIELDS, (char*)&data[0]);
+                curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE, (long)data.size());
+                CURLcode res = curl_easy_perform(curl_);
 
                 if (res != CURLE_OK)
                     fprintf(stderr, " CURL HTTP post of segment failed:  %s\n",
                         curl_easy_strerror(res));
-                else
-                    return res;
+                return res;
             }
             catch (...)
             {
@@ -128,6 +137,12 @@ struct PostCurlIngestConnection
             }
        
     }
+
+    CURL *curl_;
+
+private:
+    PostCurlIngestConnection(const PostCurlIngestConnection &);
+    PostCurlIngestConnection &operator=(const PostCurlIngestConnection &);
 };
 
 
@@ -169,6 +184,7 @@ int main(int argc, char* argv[])
     uint64_t next_L = 0;
 
     std::fstream oft("out_meta_track.cmfm" , std::ios::binary | std::ios::out);
+    PostCurlIngestConnection connection;
 
     std::vector<uint8_t> header_bytes;
     event_track::get_meta_header_bytes(opts.track_id_, opts.timescale_, header_bytes);
@@ -176,7 +192,7 @@ int main(int argc, char* argv[])
     if(opts.dry_run_)
        oft.write((const char *)&header_bytes[0], header_bytes.size());
     else
-       PostCurlIngestConnection::send_curl_post(uri, header_bytes);
+       connection.send_curl_post(uri, header_bytes);
 
     while (1) {
         
@@ -244,7 +260,7 @@ int main(int argc, char* argv[])
                 oft.flush();
             }
             else {
-                PostCurlIngestConnection::send_curl_post(uri, segment_bytes);
+                connection.send_curl_post(uri, segment_bytes);
             }
         }
     }
@@ -2,6 +2,14 @@
 #include "catch.hpp"
 #include "event/fmp4stream.h"
 #include "event/base64.h"
+#include "box_scan.h"
+#include "ingest_track.h"
+#include "ingest_metrics.h"
+#include "ingest_pacer.h"
+#include "ingest_schedule.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
 
 // box types obtained from the test files in base64 encoded from  +++ tears-of-steel-avc1-400k.cmfv
 // box types
@@ -275,6 +283,729 @@ TEST_CASE("test emsg support", "[emsg]") {
 
 }
 
+TEST_CASE("test ingest track store", "[ingest_track]") {
+
+	SECTION("find tfdt in fragment")
+	{
+		std::vector<uint8_t> bin_dat = base64_decode(t_moof_b64);
+		REQUIRE(ingest_track::find_tfdt_offset(&bin_dat[0], bin_dat.size()) == 60);
+
+		bin_dat = base64_decode(t_mfhd_b64);
+		REQUIRE(ingest_track::find_tfdt_offset(&bin_dat[0], bin_dat.size()) == 0);
+
+		// a version 1 tfdt too short for its 64 bit decode time
+		bin_dat = base64_decode(t_moof_b64);
+		bin_dat[63] = 16;
+		REQUIRE(ingest_track::find_tfdt_offset(&bin_dat[0], bin_dat.size()) == 0);
+
+		// a moof size past the end of the data
+		bin_dat = base64_decode(t_moof_b64);
+		bin_dat[0] = 0xFF;
+		REQUIRE(ingest_track::find_tfdt_offset(&bin_dat[0], bin_dat.size()) == 0);
+
+		// the same moof with a 64 bit largesize, the tfdt moves by the 8 extra header bytes
+		bin_dat = base64_decode(t_moof_b64);
+		std::vector<uint8_t> large = { 0, 0, 0, 1, 'm', 'o', 'o', 'f', 0, 0, 0, 0, 0, 0, 0, 0 };
+		large[15] = (uint8_t)(bin_dat.size() + 8);
+		large[14] = (uint8_t)((bin_dat.size() + 8) >> 8);
+		large.insert(large.end(), bin_dat.begin() + 8, bin_dat.end());
+		REQUIRE(ingest_track::find_tfdt_offset(&large[0], large.size()) == 68);
+		REQUIRE(large[68 + 8] == bin_dat[60 + 8]);
+	}
+
+	SECTION("bound the samples of a damaged trun")
+	{
+		ingest_track::track_store_t s;
+		std::vector<uint8_t> bin_dat = base64_decode(t_moof2_b64);
+		s.data_ = base64_decode(t_ftyp_b64);
+		s.init_size_ = s.data_.size();
+
+		// no sample fields and a sample count of 0xFFFFFFFF
+		bin_dat[90] = 0;
+		bin_dat[92] = bin_dat[93] = bin_dat[94] = bin_dat[95] = 0xFF;
+
+		ingest_track::fragment_entry_t f = {};
+		f.offset_ = s.data_.size();
+		f.size_ = bin_dat.size();
+		s.data_.insert(s.data_.end(), bin_dat.begin(), bin_dat.end());
+		s.fragments_.push_back(f);
+
+		std::vector<ingest_track::sample_entry_t> samples;
+		REQUIRE(s.get_samples(0, samples));
+		REQUIRE(samples.size() == bin_dat.size());
+	}
+
+	SECTION("patch tfdt and segment views")
+	{
+		ingest_track::track_store_t s;
+		std::vector<uint8_t> bin_dat = base64_decode(t_moof2_b64);
+		s.data_ = base64_decode(t_ftyp_b64);
+		s.init_size_ = s.data_.size();
+
+		ingest_track::fragment_entry_t f = {};
+		f.offset_ = s.data_.size();
+		f.size_ = bin_dat.size();
+		f.base_media_decode_time_ = 49152;
+		f.duration_ = 49152;
+		f.tfdt_offset_ = f.offset_ + ingest_track::find_tfdt_offset(&bin_dat[0], bin_dat.size());
+		f.tfdt_version_ = 1;
+		f.mfhd_offset_ = f.offset_ + 8;
+		f.sequence_number_ = 2;
+		s.data_.insert(s.data_.end(), bin_dat.begin(), bin_dat.end());
+		s.fragments_.push_back(f);
+
+		ingest_track::segment_view_t v = s.get_media_segment(0);
+		REQUIRE(v.size_ == bin_dat.size());
+		REQUIRE(memcmp(v.data_, &bin_dat[0], v.size_) == 0);
+		REQUIRE(s.get_init_segment().size_ == s.init_size_);
+
+		// a loop offset patches a copy, the track bytes are left as is
+		std::vector<uint8_t> seg_buf;
+		v = s.get_media_segment(0, 49152, 0, seg_buf);
+		REQUIRE(v.data_ == &seg_buf[0]);
+		fmp4_stream::tfdt t = fmp4_stream::tfdt();
+		t.parse((char *)&seg_buf[f.tfdt_offset_ - f.offset_]);
+		REQUIRE(t.base_media_decode_time_ == 98304);
+		REQUIRE(memcmp(s.get_media_segment(0).data_, &bin_dat[0], bin_dat.size()) == 0);
+		REQUIRE(s.get_media_segment(0, 0, 0, seg_buf).data_ == s.get_media_segment(0).data_);
+
+		// the sequence number of a later loop continues after the last fragment
+		v = s.get_media_segment(0, 49152, 1, seg_buf);
+		fmp4_stream::mfhd m = fmp4_stream::mfhd();
+		m.parse((char *)&seg_buf[f.mfhd_offset_ - f.offset_]);
+		REQUIRE(m.seq_nr_ == 3);
+		REQUIRE(memcmp(s.get_media_segment(0).data_, &bin_dat[0], bin_dat.size()) == 0);
+		REQUIRE(s.get_start_time() == 49152);
+		REQUIRE(s.get_duration() == 49152);
+
+		// a version 0 tfdt keeps the low 32 bits of a decode time that does not fit
+		s.fragments_[0].tfdt_version_ = 0;
+		s.data_[f.tfdt_offset_ + 8] = 0;
+		v = s.get_media_segment(0, 1ULL << 32, 0, seg_buf);
+		REQUIRE(seg_buf[f.tfdt_offset_ - f.offset_ + 8] == 0); // the version in the copy
+		REQUIRE(seg_buf[f.tfdt_offset_ - f.offset_ + 12] == 0);
+		REQUIRE(seg_buf[f.tfdt_offset_ - f.offset_ + 14] == 0xc0); // 49152
+	}
+
+	SECTION("load and index a mapped file")
+	{
+		std::vector<uint8_t> ftyp = base64_decode(t_ftyp_b64);
+		std::vector<uint8_t> free_box = base64_decode(t_free_b64);
+		std::vector<uint8_t> moov = base64_decode(t_moov_b64);
+		std::vector<uint8_t> moof = base64_decode(t_moof2_b64);
+		const uint8_t mdat[] = { 0, 0, 0, 8, 'm', 'd', 'a', 't' };
+
+		std::ofstream out("test_mapped.cmfv", std::ios::binary);
+		out.write((char *)&ftyp[0], ftyp.size());
+		out.write((char *)&free_box[0], free_box.size());
+		out.write((char *)&moov[0], moov.size());
+		out.write((char *)&moof[0], moof.size());
+		out.write((char *)mdat, sizeof(mdat));
+		out.close();
+
+		ingest_track::track_store_t s;
+		std::remove(ingest_track::get_index_name("test_mapped.cmfv").c_str());
+		REQUIRE(s.load_from_file("test_mapped.cmfv", true));
+		REQUIRE(s.init_size_ == ftyp.size() + moov.size()); // free box is not part of the init segment
+		REQUIRE(s.timescale_ == 12288);
+		REQUIRE(s.fragments_.size() == 1);
+		REQUIRE(s.get_media_segment(0).size_ == moof.size() + sizeof(mdat));
+		REQUIRE(s.get_start_time() == 49152);
+		REQUIRE(s.get_duration() == 49152); // 96 samples of the tfhd default duration 512
+		REQUIRE(s.fragments_[0].sequence_number_ == 2);
+		REQUIRE(s.fragments_[0].mfhd_offset_ == ftyp.size() + free_box.size() + moov.size() + 8);
+		REQUIRE(s.fragments_[0].sync_ == 1); // first sample flags override the non sync tfhd default
+
+		// the sample table is only decoded on request
+		std::vector<ingest_track::sample_entry_t> samples;
+		REQUIRE(s.get_samples(0, samples));
+		REQUIRE(samples.size() == 96);
+		REQUIRE(samples[0].decode_time_ == 49152);
+		REQUIRE(samples[0].size_ == 1933);
+		REQUIRE(!(samples[0].flags_ & 0x10000));
+		REQUIRE((samples[1].flags_ & 0x10000));
+		REQUIRE(samples[95].decode_time_ == 49152 + 95 * 512);
+		REQUIRE(!s.get_samples(1, samples));
+
+		// the walk wrote the fragment index, the next load reads it
+		ingest_track::track_store_t si;
+		REQUIRE(si.map_.open("test_mapped.cmfv"));
+		REQUIRE(si.load_index(ingest_track::get_index_name("test_mapped.cmfv")));
+		REQUIRE(si.init_size_ == s.init_size_);
+		REQUIRE(memcmp(si.get_init_segment().data_, s.get_init_segment().data_, (size_t)s.init_size_) == 0);
+		REQUIRE(si.timescale_ == 12288);
+		REQUIRE(si.fragments_.size() == 1);
+		REQUIRE(si.fragments_[0].offset_ == s.fragments_[0].offset_);
+		REQUIRE(si.fragments_[0].size_ == s.fragments_[0].size_);
+		REQUIRE(si.fragments_[0].tfdt_offset_ == s.fragments_[0].tfdt_offset_);
+		REQUIRE(si.fragments_[0].mfhd_offset_ == s.fragments_[0].mfhd_offset_);
+		REQUIRE(si.get_start_time() == 49152);
+		REQUIRE(si.get_duration() == 49152);
+		REQUIRE(si.fragments_[0].sequence_number_ == 2);
+		REQUIRE(si.fragments_[0].sync_ == 1);
+
+		// a loop offset patches a copy of the mapped fragment, not the file
+		std::vector<uint8_t> seg_buf;
+		ingest_track::segment_view_t v = s.get_media_segment(0, 49152, 1, seg_buf);
+		REQUIRE(v.data_ == &seg_buf[0]);
+		fmp4_stream::tfdt t = fmp4_stream::tfdt();
+		t.parse((char *)&seg_buf[s.fragments_[0].tfdt_offset_ - s.fragments_[0].offset_]);
+		REQUIRE(t.base_media_decode_time_ == 98304);
+		REQUIRE(s.load_from_file("test_mapped.cmfv", true));
+		REQUIRE(s.get_start_time() == 49152);
+		REQUIRE(memcmp(s.get_media_segment(0).data_, &moof[0], moof.size()) == 0);
+
+		// a file that changed after the index was written is walked again
+		std::ofstream app("test_mapped.cmfv", std::ios::binary | std::ios::app);
+		app.write((char *)&moof[0], moof.size());
+		app.write((char *)mdat, sizeof(mdat));
+		app.close();
+		REQUIRE(si.map_.open("test_mapped.cmfv"));
+		REQUIRE(!si.load_index(ingest_track::get_index_name("test_mapped.cmfv")));
+		REQUIRE(s.load_from_file("test_mapped.cmfv", true));
+		REQUIRE(s.fragments_.size() == 2);
+		REQUIRE(s.fragments_.capacity() == 2); // the moof boxes are counted before the walk
+
+#ifndef _WIN32
+		// rewritten with the same size, usually within the same second
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		std::vector<uint8_t> same(s.map_.data(), s.map_.data() + s.map_.size());
+		std::ofstream rewrite("test_mapped.cmfv", std::ios::binary);
+		rewrite.write((char *)&same[0], same.size());
+		rewrite.close();
+		REQUIRE(si.map_.open("test_mapped.cmfv"));
+		REQUIRE(!si.load_index(ingest_track::get_index_name("test_mapped.cmfv")));
+#endif
+
+		std::remove("test_mapped.cmfv");
+		std::remove(ingest_track::get_index_name("test_mapped.cmfv").c_str());
+	}
+
+	SECTION("group the chunks of a segment")
+	{
+		std::vector<uint8_t> ftyp = base64_decode(t_ftyp_b64);
+		std::vector<uint8_t> moov = base64_decode(t_moov_b64);
+		std::vector<uint8_t> moof = base64_decode(t_moof2_b64);
+		const uint8_t mdat[] = { 0, 0, 0, 8, 'm', 'd', 'a', 't' };
+		const uint8_t styp[] = { 0, 0, 0, 16, 's', 't', 'y', 'p', 'c', 'm', 'f', 's', 0, 0, 0, 0 };
+
+		// styp chunk chunk, styp chunk: segments of two and one chunks
+		std::ofstream out("test_chunks.cmfv", std::ios::binary);
+		out.write((char *)&ftyp[0], ftyp.size());
+		out.write((char *)&moov[0], moov.size());
+		for (int i = 0; i < 3; i++)
+		{
+			if (i != 1)
+				out.write((char *)styp, sizeof(styp));
+			out.write((char *)&moof[0], moof.size());
+			out.write((char *)mdat, sizeof(mdat));
+		}
+		out.close();
+
+		ingest_track::track_store_t s;
+		std::remove(ingest_track::get_index_name("test_chunks.cmfv").c_str());
+		REQUIRE(s.load_from_file("test_chunks.cmfv", true));
+		REQUIRE(s.fragments_.size() == 3);
+		REQUIRE(s.get_segment_end(0) == 2);
+		REQUIRE(s.get_segment_end(1) == 2);
+		REQUIRE(s.get_segment_end(2) == 3);
+
+		// the segment starts are kept in the fragment index
+		ingest_track::track_store_t si;
+		REQUIRE(si.load_from_file("test_chunks.cmfv", true));
+		REQUIRE(si.fragments_[1].segment_start_ == 0);
+		REQUIRE(si.get_segment_end(0) == 2);
+
+		// without styp boxes each sync chunk starts a segment
+		std::ofstream plain("test_chunks.cmfv", std::ios::binary);
+		plain.write((char *)&ftyp[0], ftyp.size());
+		plain.write((char *)&moov[0], moov.size());
+		for (int i = 0; i < 2; i++)
+		{
+			plain.write((char *)&moof[0], moof.size());
+			plain.write((char *)mdat, sizeof(mdat));
+		}
+		plain.close();
+		REQUIRE(s.load_from_file("test_chunks.cmfv"));
+		REQUIRE(s.get_segment_end(0) == 1);
+		REQUIRE(s.get_segment_end(1) == 2);
+
+		std::remove("test_chunks.cmfv");
+		std::remove(ingest_track::get_index_name("test_chunks.cmfv").c_str());
+	}
+
+	SECTION("validate a track one segment at a time")
+	{
+		std::vector<uint8_t> init = base64_decode(t_ftyp_b64);
+		std::vector<uint8_t> moov = base64_decode(t_moov_b64);
+		init.insert(init.end(), moov.begin(), moov.end());
+		std::vector<uint8_t> frag = base64_decode(t_moof2_b64);
+		const uint8_t mdat[] = { 0, 0, 0, 8, 'm', 'd', 'a', 't' };
+		frag.insert(frag.end(), mdat, mdat + sizeof(mdat));
+
+		ingest_track::track_validator_t v;
+		v.check_init_segment(&init[0], init.size(), 0);
+		REQUIRE(v.findings_.size() == 0);
+
+		ingest_track::fragment_entry_t f = {};
+		f.offset_ = init.size();
+		f.size_ = frag.size();
+		f.base_media_decode_time_ = 49152;
+		f.duration_ = 49152;
+		f.tfdt_offset_ = f.offset_ + 60;
+		f.sequence_number_ = 2;
+		v.check_media_segment(&frag[0], f);
+		REQUIRE(v.findings_.size() == 1);
+		REQUIRE(v.findings_[0].check_ == "trun_mdat_size"); // the samples are not in the empty mdat
+
+		// the same fragment again repeats its sequence number and decode time
+		v.findings_.clear();
+		f.offset_ += frag.size();
+		f.tfdt_offset_ += frag.size();
+		v.check_media_segment(&frag[0], f);
+		REQUIRE(v.findings_.size() == 3);
+		REQUIRE(v.findings_[0].check_ == "sequence_number");
+		REQUIRE(v.findings_[2].check_ == "tfdt_monotonic");
+
+		v.check_end(f.offset_ + f.size_, 0);
+		REQUIRE(v.fragments_ == 2);
+		REQUIRE(v.finding_count_ == 4);
+	}
+
+	SECTION("read a track incrementally")
+	{
+		std::vector<uint8_t> ftyp = base64_decode(t_ftyp_b64);
+		std::vector<uint8_t> free_box = base64_decode(t_free_b64);
+		std::vector<uint8_t> moov = base64_decode(t_moov_b64);
+		std::vector<uint8_t> moof = base64_decode(t_moof2_b64);
+		const uint8_t mdat[] = { 0, 0, 0, 8, 'm', 'd', 'a', 't' };
+
+		// the last fragment is cut off like a file that is still being written
+		std::ofstream out("test_stream.cmfv", std::ios::binary);
+		out.write((char *)&ftyp[0], ftyp.size());
+		out.write((char *)&free_box[0], free_box.size());
+		out.write((char *)&moov[0], moov.size());
+		out.write((char *)&moof[0], moof.size());
+		out.write((char *)mdat, sizeof(mdat));
+		out.write((char *)&moof[0], moof.size() / 2);
+		out.close();
+
+		ingest_track::track_reader_t r;
+		std::vector<uint8_t> seg;
+		ingest_track::fragment_entry_t f;
+		REQUIRE(r.open("test_stream.cmfv", true, 200));
+		r.time_offset_ = 49152;
+
+		REQUIRE(r.read_segment(seg, f) == ingest_track::init_segment);
+		REQUIRE(seg.size() == ftyp.size() + moov.size()); // free box is not part of the init segment
+		REQUIRE(f.offset_ == 0);
+		REQUIRE(f.size_ == seg.size());
+		REQUIRE(r.timescale_ == 12288);
+
+		REQUIRE(r.read_segment(seg, f) == ingest_track::media_segment);
+		REQUIRE(seg.size() == moof.size() + sizeof(mdat));
+		REQUIRE(f.offset_ == ftyp.size() + free_box.size() + moov.size());
+		REQUIRE(f.base_media_decode_time_ == 98304);
+		REQUIRE(f.duration_ == 49152);
+		fmp4_stream::tfdt t = fmp4_stream::tfdt();
+		t.parse((char *)&seg[f.tfdt_offset_ - f.offset_]);
+		REQUIRE(t.base_media_decode_time_ == 98304);
+
+		// the file did not grow within the idle timeout
+		REQUIRE(r.read_segment(seg, f) == ingest_track::end_of_input);
+		r.close();
+		std::remove("test_stream.cmfv");
+	}
+
+	SECTION("read past a damaged box size")
+	{
+		std::vector<uint8_t> ftyp = base64_decode(t_ftyp_b64);
+		std::vector<uint8_t> moov = base64_decode(t_moov_b64);
+		std::vector<uint8_t> moof = base64_decode(t_moof2_b64);
+		const uint8_t mdat[] = { 0, 0, 0, 8, 'm', 'd', 'a', 't' };
+		const uint8_t damaged_mdat[] = { 0xff, 0xff, 0xff, 0xf0, 'm', 'd', 'a', 't' };
+		const uint8_t open_mdat[] = { 0, 0, 0, 0, 'm', 'd', 'a', 't', 1, 2, 3, 4 };
+
+		// a fragment with an mdat size beyond the limit, a good one and one with an
+		// mdat that extends to the end of the input
+		std::ofstream out("test_damaged.cmfv", std::ios::binary);
+		out.write((char *)&ftyp[0], ftyp.size());
+		out.write((char *)&moov[0], moov.size());
+		out.write((char *)&moof[0], moof.size());
+		out.write((char *)damaged_mdat, sizeof(damaged_mdat));
+		out.write((char *)&moof[0], moof.size());
+		out.write((char *)mdat, sizeof(mdat));
+		out.write((char *)&moof[0], moof.size());
+		out.write((char *)open_mdat, sizeof(open_mdat));
+		out.close();
+
+		ingest_track::track_reader_t r;
+		std::vector<uint8_t> seg;
+		ingest_track::fragment_entry_t f;
+		REQUIRE(r.open("test_damaged.cmfv", false, 0));
+		REQUIRE(r.read_segment(seg, f) == ingest_track::init_segment);
+
+		// the damaged fragment is dropped instead of buffering 4 GB
+		REQUIRE(r.read_segment(seg, f) == ingest_track::media_segment);
+		REQUIRE(f.offset_ == ftyp.size() + moov.size() + moof.size() + sizeof(damaged_mdat));
+		REQUIRE(seg.size() == moof.size() + sizeof(mdat));
+		REQUIRE(r.buf_.size() <= r.max_segment_size_);
+
+		REQUIRE(r.read_segment(seg, f) == ingest_track::media_segment);
+		REQUIRE(seg.size() == moof.size() + sizeof(open_mdat));
+		REQUIRE(seg[seg.size() - 1] == 4);
+
+		REQUIRE(r.read_segment(seg, f) == ingest_track::end_of_input);
+		r.close();
+		std::remove("test_damaged.cmfv");
+	}
+}
+
+TEST_CASE("test box scan", "[box_scan]") {
+
+	SECTION("find the next fragment box")
+	{
+		std::vector<uint8_t> moof = base64_decode(t_moof2_b64);
+		std::vector<uint8_t> d(1000, 'm');
+		d.insert(d.end(), moof.begin(), moof.end());
+
+		REQUIRE(box_scan::find_fragment_box(&d[0], d.size()) == 1000);
+		REQUIRE(box_scan::find_fragment_box_scalar(&d[0], d.size()) == 1000);
+
+		// a size that does not fit the remaining bytes is not a box
+		d.resize(d.size() - 1);
+		REQUIRE(box_scan::find_fragment_box(&d[0], d.size()) == d.size());
+		REQUIRE(box_scan::find_fragment_box_scalar(&d[0], d.size()) == d.size());
+	}
+
+	SECTION("skip a damaged box when loading a file")
+	{
+		std::vector<uint8_t> ftyp = base64_decode(t_ftyp_b64);
+		std::vector<uint8_t> moov = base64_decode(t_moov_b64);
+		std::vector<uint8_t> moof = base64_decode(t_moof2_b64);
+		const uint8_t mdat[] = { 0, 0, 0, 8, 'm', 'd', 'a', 't' };
+		const uint8_t damaged[] = { 0xFF, 0xFF, 0xFF, 0xFF, 'm', 'o', 'o', 'f', 0, 0, 0, 0 };
+
+		std::ofstream out("test_damaged.cmfv", std::ios::binary);
+		out.write((char *)&ftyp[0], ftyp.size());
+		out.write((char *)&moov[0], moov.size());
+		out.write((char *)damaged, sizeof(damaged));
+		out.write((char *)&moof[0], moof.size());
+		out.write((char *)mdat, sizeof(mdat));
+		out.close();
+
+		ingest_track::track_store_t s;
+		REQUIRE(s.load_from_file("test_damaged.cmfv", false));
+		REQUIRE(s.fragments_.size() == 1);
+		REQUIRE(s.fragments_[0].offset_ == ftyp.size() + moov.size() + sizeof(damaged));
+		REQUIRE(s.get_start_time() == 49152);
+		std::remove("test_damaged.cmfv");
+	}
+}
+
+TEST_CASE("test ingest metrics", "[ingest_metrics]") {
+
+	SECTION("write track metrics in the text format")
+	{
+		ingest_metrics::metrics_registry_t m;
+		ingest_metrics::track_metrics_t *t = m.add_track("video.cmfv");
+		t->post_done(0.02, 1000, true);
+		t->post_done(20.0, 500, false);
+		t->retry_done();
+		t->fragment_sent(2.0, 2.5, 2.0);
+		t->fragment_sent(4.0, 6.5, 2.0); // more than a fragment duration late
+
+		std::ostringstream os;
+		m.write(os);
+		const std::string out = os.str();
+		REQUIRE(out.find("fmp4ingest_posts_total{track=\"video.cmfv\"} 2\n") != std::string::npos);
+		REQUIRE(out.find("fmp4ingest_post_errors_total{track=\"video.cmfv\"} 1\n") != std::string::npos);
+		REQUIRE(out.find("fmp4ingest_bytes_total{track=\"video.cmfv\"} 1000\n") != std::string::npos);
+		REQUIRE(out.find("fmp4ingest_retries_total{track=\"video.cmfv\"} 1\n") != std::string::npos);
+		REQUIRE(out.find("fmp4ingest_deadline_misses_total{track=\"video.cmfv\"} 1\n") != std::string::npos);
+		REQUIRE(out.find("fmp4ingest_media_lag_seconds{track=\"video.cmfv\"} 2.5\n") != std::string::npos);
+		REQUIRE(out.find("fmp4ingest_post_latency_seconds_bucket{track=\"video.cmfv\",le=\"0.025\"} 1\n") != std::string::npos);
+		REQUIRE(out.find("fmp4ingest_post_latency_seconds_bucket{track=\"video.cmfv\",le=\"+Inf\"} 2\n") != std::string::npos);
+	}
+}
+
+TEST_CASE("test ingest pacer", "[ingest_pacer]") {
+
+	SECTION("deadlines of a long timeline do not drift")
+	{
+		REQUIRE(ingest_pacer::ticks_to_duration(90000, 90000) == std::chrono::seconds(1));
+		REQUIRE(ingest_pacer::ticks_to_duration(1, 3) == std::chrono::nanoseconds(333333333));
+		REQUIRE(ingest_pacer::ticks_to_duration(12345, 0) == std::chrono::nanoseconds(0));
+
+		// a week at 90 kHz overflows ticks * 1e9, the seconds stay exact
+		const uint64_t week = 7ULL * 24 * 3600;
+		REQUIRE(ingest_pacer::ticks_to_duration(week * 90000 + 45000, 90000) == std::chrono::seconds(week) + std::chrono::milliseconds(500));
+
+		// 1001 / 30000 fragments, the deadline of fragment n does not depend on the ones before
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		ingest_pacer::media_clock_t clock(start);
+		REQUIRE(clock.get_deadline(0, 30000) == start);
+		REQUIRE(clock.get_deadline(30000ULL * 1001 * 3600, 30000) - start == std::chrono::seconds(1001 * 3600));
+		REQUIRE(clock.get_elapsed(start + std::chrono::milliseconds(1500)) == 1.5);
+	}
+
+	SECTION("take the tracks in deadline order")
+	{
+		ingest_pacer::deadline_queue_t q;
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		q.push(3, now - std::chrono::milliseconds(10));
+		q.push(1, now - std::chrono::milliseconds(30));
+		q.push(2, now - std::chrono::milliseconds(10)); // same deadline as 3, pushed later
+		q.push(4, now + std::chrono::milliseconds(20));
+
+		size_t id = 0;
+		REQUIRE(q.pop_due(id));
+		REQUIRE(id == 1);
+		REQUIRE(q.pop_due(id));
+		REQUIRE(id == 3);
+		REQUIRE(q.pop_due(id));
+		REQUIRE(id == 2);
+
+		// the last one is only taken when it is due
+		REQUIRE(q.pop_due(id));
+		REQUIRE(id == 4);
+		REQUIRE(std::chrono::steady_clock::now() >= now + std::chrono::milliseconds(20));
+
+		q.close();
+		REQUIRE(!q.pop_due(id));
+	}
+
+	SECTION("dispatch the tracks in deadline order until all are done")
+	{
+		ingest_pacer::deadline_queue_t q;
+		std::atomic<size_t> active(4);
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		for (size_t k = 0; k < 4; k++)
+			q.push(k, now + std::chrono::milliseconds(10 * (3 - k)));
+
+		// track 0 is sent twice, it is due again after the others
+		std::vector<size_t> order;
+		ingest_pacer::run_worker(q, active, [&](size_t id, std::chrono::steady_clock::time_point &next)
+		{
+			order.push_back(id);
+			next = now + std::chrono::milliseconds(40);
+			return id == 0 && order.size() == 4;
+		});
+
+		// the worker returned because the last track was done
+		REQUIRE(active == 0);
+		REQUIRE(q.closed_);
+		REQUIRE(order == std::vector<size_t>({ 3, 2, 1, 0, 0 }));
+	}
+
+	SECTION("a track is sent by one worker at a time")
+	{
+		const size_t tracks = 8;
+		const int sends = 20;
+		ingest_pacer::deadline_queue_t q;
+		std::atomic<size_t> active(tracks);
+		std::vector<std::atomic<int> > busy(tracks);
+		std::vector<int> sent(tracks, 0);
+		std::atomic<bool> overlap(false);
+		for (size_t k = 0; k < tracks; k++)
+		{
+			busy[k] = 0;
+			q.push(k, std::chrono::steady_clock::now());
+		}
+
+		ingest_pacer::send_function_t send = [&](size_t id, std::chrono::steady_clock::time_point &next)
+		{
+			if (busy[id].exchange(1))
+				overlap = true;
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+			const bool more = ++sent[id] < sends;
+			busy[id] = 0;
+			next = std::chrono::steady_clock::now();
+			return more;
+		};
+
+		std::vector<std::thread> workers;
+		for (int n = 0; n < 4; n++)
+			workers.push_back(std::thread(ingest_pacer::run_worker, std::ref(q), std::ref(active), std::cref(send)));
+		for (auto &w : workers)
+			w.join();
+
+		REQUIRE(!overlap);
+		REQUIRE(active == 0);
+		for (size_t k = 0; k < tracks; k++)
+			REQUIRE(sent[k] == sends);
+	}
+}
+
+TEST_CASE("test ingest schedule", "[ingest_schedule]") {
+
+	SECTION("decode times and deadlines of the loops")
+	{
+		ingest_track::track_store_t s;
+		std::vector<uint8_t> bin_dat = base64_decode(t_moof2_b64);
+		s.data_ = base64_decode(t_ftyp_b64);
+		s.init_size_ = s.data_.size();
+		s.timescale_ = 12288;
+
+		// two fragments of 4 seconds, the moof says decode time 49152 and sequence 2
+		for (int i = 0; i < 2; i++)
+		{
+			ingest_track::fragment_entry_t f = {};
+			f.offset_ = s.data_.size();
+			f.size_ = bin_dat.size();
+			f.base_media_decode_time_ = 49152 * (i + 1);
+			f.duration_ = 49152;
+			f.tfdt_offset_ = f.offset_ + ingest_track::find_tfdt_offset(&bin_dat[0], bin_dat.size());
+			f.tfdt_version_ = 1;
+			f.mfhd_offset_ = f.offset_ + 8;
+			f.sequence_number_ = 2;
+			s.data_.insert(s.data_.end(), bin_dat.begin(), bin_dat.end());
+			s.fragments_.push_back(f);
+		}
+
+		ingest_schedule::loop_timeline_t timeline(s, 8.0, 1000);
+		REQUIRE(timeline.duration_ == 98304);
+		REQUIRE(timeline.get_offset(0) == 1000);
+		REQUIRE(timeline.get_offset(2) == 1000 + 2 * 98304);
+		REQUIRE(timeline.get_decode_time(1, 1) == 98304 + 1000 + 98304);
+
+		// the pacing timeline starts at the first fragment and continues over the loops
+		REQUIRE(timeline.get_media_ticks(0, 0) == 0);
+		REQUIRE(timeline.get_media_ticks(1, 1) == 49152 + 98304);
+		REQUIRE(timeline.get_media_time(1, 1) == 12.0);
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		REQUIRE(timeline.get_deadline(ingest_pacer::media_clock_t(start), 1, 1) == start + std::chrono::seconds(12));
+
+		// the second loop is sent with shifted decode times and continued sequence numbers
+		std::vector<uint8_t> buf;
+		ingest_track::segment_view_t v = timeline.get_segment(0, 1, buf);
+		fmp4_stream::tfdt t = fmp4_stream::tfdt();
+		t.parse((char *)&buf[s.fragments_[0].tfdt_offset_ - s.fragments_[0].offset_]);
+		REQUIRE(t.base_media_decode_time_ == 49152 + 1000 + 98304);
+		fmp4_stream::mfhd m = fmp4_stream::mfhd();
+		m.parse((char *)&buf[8]);
+		REQUIRE(m.seq_nr_ == 4);
+		REQUIRE(v.size_ == bin_dat.size());
+
+		// a duration that is not a whole number of ticks is rounded
+		REQUIRE(ingest_schedule::loop_timeline_t(s, 1.0 / 3, 0).duration_ == 4096);
+	}
+
+	SECTION("back off the resends with jitter")
+	{
+		ingest_schedule::retry_queue_t r;
+		for (int attempts = 0; attempts < 7; attempts++)
+		{
+			const int64_t base = (int64_t)300 << (attempts < 4 ? attempts : 4); // capped at 4.8 seconds
+			bool jittered = false;
+			for (int k = 0; k < 50; k++)
+			{
+				const int64_t ms = r.backoff(attempts).count();
+				REQUIRE(ms >= base);
+				REQUIRE(ms <= base + base / 2);
+				jittered |= ms != base;
+			}
+			REQUIRE(jittered);
+		}
+	}
+
+	SECTION("resend the failed segments in order")
+	{
+		ingest_schedule::retry_queue_t r;
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		r.push(7, 0, 0); // a window of 0 disables the resends
+		REQUIRE(r.empty());
+		REQUIRE(r.next_try() == std::chrono::steady_clock::time_point::max());
+
+		r.push(1, 0, 10000);
+		r.push(2, 0, 10000);
+		r.push(3, 1, 10000);
+		REQUIRE(!r.get_due(now)); // the first resend waits for the backoff
+		REQUIRE(r.next_try() >= now + std::chrono::milliseconds(300));
+
+		ingest_schedule::retry_entry_t *e = r.get_due(now + std::chrono::milliseconds(500));
+		REQUIRE(e);
+		REQUIRE(e->fnumber_ == 1);
+		r.done();
+
+		// a failed resend keeps its place and waits twice as long
+		e = r.get_due(now + std::chrono::milliseconds(500));
+		REQUIRE(e);
+		REQUIRE(e->fnumber_ == 2);
+		r.failed();
+		REQUIRE(r.resend_init_);
+		REQUIRE(r.queue_.front().fnumber_ == 2);
+		REQUIRE(r.queue_.front().attempts_ == 1);
+		REQUIRE(r.next_try() >= now + std::chrono::milliseconds(600));
+		REQUIRE(!r.get_due(now + std::chrono::milliseconds(500)));
+
+		e = r.get_due(now + std::chrono::milliseconds(1500));
+		REQUIRE(e);
+		REQUIRE(e->fnumber_ == 2);
+		r.done();
+		REQUIRE(r.queue_.front().loop_ == 1);
+
+		// not resent within the window, the segment is dropped
+		REQUIRE(!r.get_due(now + std::chrono::milliseconds(10001) + (std::chrono::steady_clock::now() - now)));
+		REQUIRE(r.empty());
+	}
+
+	SECTION("send the live segment at its deadline and resend in the slack")
+	{
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		const std::chrono::steady_clock::time_point later = now + std::chrono::seconds(10);
+		std::chrono::steady_clock::time_point next = later;
+
+		// the init segment is sent at the deadline, next is lowered to it
+		ingest_schedule::track_schedule_t t;
+		t.deadline_ = now + std::chrono::seconds(2);
+		REQUIRE(!t.get_due(now, next));
+		REQUIRE(next == t.deadline_);
+		REQUIRE(t.get_due(now + std::chrono::seconds(2), next));
+		REQUIRE(!t.retrying_);
+
+		// a failed segment waits for its backoff, next is lowered to the resend
+		t.init_done_ = true;
+		t.retries_.push(3, 0, 10000);
+		next = later;
+		REQUIRE(!t.get_due(now, next));
+		REQUIRE(next == t.retries_.next_try());
+
+		// it is resent in the slack before the live segment
+		REQUIRE(t.get_due(now + std::chrono::seconds(1), next));
+		REQUIRE(t.retrying_);
+		t.retrying_ = false;
+
+		// the live segment goes first when it is due
+		t.deadline_ = now + std::chrono::milliseconds(500);
+		REQUIRE(t.get_due(now + std::chrono::seconds(1), next));
+		REQUIRE(!t.retrying_);
+
+		// after the last fragment only the resends are left, then the mfra is posted
+		t.draining_ = true;
+		next = later;
+		REQUIRE(!t.get_due(now, next));
+		REQUIRE(next == t.retries_.next_try());
+		REQUIRE(t.get_due(now + std::chrono::seconds(1), next));
+		REQUIRE(t.retrying_);
+		t.retrying_ = false;
+		t.retries_.done();
+		REQUIRE(t.get_due(now + std::chrono::seconds(1), next));
+		REQUIRE(t.closing_);
+		REQUIRE(!t.draining_);
+		REQUIRE(!t.is_done_);
+
+		// a track that is not closed is done instead
+		ingest_schedule::track_schedule_t u;
+		u.close_ = false;
+		u.init_done_ = true;
+		u.draining_ = true;
+		u.deadline_ = now;
+		REQUIRE(!u.get_due(now, next));
+		REQUIRE(u.is_done_);
+	}
+}
+
 /* todo additional unit tests 
 TEST_CASE("test emsg track", "[emsg_track]") {
 